@@ -0,0 +1,118 @@
+/////////////////////////////////////////////////////////////////////////
+/// Nuclear recoil (keV) to electron equivalent (keVee) energy transform
+/// of the WIMP recoil spectra.
+///
+/// A recoil of energy E (keV) is seen as E*Q(E) keVee, where Q is the
+/// quenching factor given by TRestWimpSensitivity::GetQuenchingFactor().
+/// The counts of every recoil bin [a, b] are spread uniformly over
+/// [a*Q(a), b*Q(b)] and shared among the keVee bins it overlaps, so the
+/// energy axis is properly rebinned and the total rate is conserved (for
+/// the part falling inside the keVee axis). This mapping only depends on
+/// the nucleus and the binning, so it is stored once as a sparse matrix
+/// and applying it to any recoil spectrum is a single pass over its
+/// non-zero elements.
+///
+/// \author: Álvaro Ezquerro aezquerro@unizar.es
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef REST_MACROS_WIMP_QUENCHING_H
+#define REST_MACROS_WIMP_QUENCHING_H
+
+#include <TH1D.h>
+#include <TRestWimpSensitivity.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+class QuenchingTransform {
+   public:
+    /// recoilAxis is the binning of the recoil spectra (keV). The keVee
+    /// spectra use the same binning (in keVee).
+    QuenchingTransform(TH1& quenchingFactor, const TAxis& recoilAxis)
+        : fNBins(recoilAxis.GetNbins()), fXMin(recoilAxis.GetXmin()), fXMax(recoilAxis.GetXmax()) {
+        // The quenching factor is interpolated at the bin edges
+        const TAxis* qfAxis = quenchingFactor.GetXaxis();
+        auto toKeVee = [&](const double energy) {
+            const double e = std::clamp(energy, qfAxis->GetBinCenter(1), qfAxis->GetBinCenter(qfAxis->GetNbins()));
+            return energy * quenchingFactor.Interpolate(e);
+        };
+
+        fRowStart.push_back(0);
+        for (int i = 1; i <= fNBins; i++) {
+            const double low = recoilAxis.GetBinLowEdge(i);
+            const double high = recoilAxis.GetBinUpEdge(i);
+            const double lowEE = toKeVee(low);
+            const double highEE = toKeVee(high);
+
+            const int first = std::max(1, recoilAxis.FindFixBin(lowEE));
+            const int last = std::min(fNBins, recoilAxis.FindFixBin(highEE));
+            for (int j = first; j <= last; j++) {
+                const double widthEE = recoilAxis.GetBinWidth(j);
+                double fraction = 1;
+                if (highEE > lowEE) {
+                    const double overlap = std::min(highEE, recoilAxis.GetBinUpEdge(j)) -
+                                           std::max(lowEE, recoilAxis.GetBinLowEdge(j));
+                    if (overlap <= 0) continue;
+                    fraction = overlap / (highEE - lowEE);
+                }
+                fTargets.push_back(j);
+                fWeights.push_back((high - low) * fraction / widthEE);
+            }
+            fRowStart.push_back(fTargets.size());
+        }
+    }
+
+    /// Returns a new histogram (owned by the caller) with the keVee spectrum
+    /// of recoilSpectrum, which must have the binning given at construction.
+    TH1D* Apply(const TH1D& recoilSpectrum, const std::string& name) const {
+        if (recoilSpectrum.GetNbinsX() != fNBins) {
+            std::cout << "Error: " << recoilSpectrum.GetName() << " binning does not match the quenching transform"
+                      << std::endl;
+            return nullptr;
+        }
+        TH1D* spectrumEE = new TH1D(name.c_str(), recoilSpectrum.GetTitle(), fNBins, fXMin, fXMax);
+        const double* in = recoilSpectrum.GetArray();
+        double* out = spectrumEE->GetArray();
+        for (int i = 1; i <= fNBins; i++) {
+            if (in[i] == 0) continue;
+            for (size_t k = fRowStart[i - 1]; k < fRowStart[i]; k++) out[fTargets[k]] += fWeights[k] * in[i];
+        }
+        spectrumEE->GetXaxis()->SetTitle("Energy (keVee)");
+        spectrumEE->GetYaxis()->SetTitle("Recoil rate (c/keVee/kg/day)");
+        return spectrumEE;
+    }
+
+    size_t GetNumberOfElements() const { return fWeights.size(); }
+
+   private:
+    int fNBins;
+    double fXMin;
+    double fXMax;
+    // Sparse matrix in compressed row format (one row per recoil bin)
+    std::vector<size_t> fRowStart;
+    std::vector<int> fTargets;
+    std::vector<double> fWeights;
+};
+
+/// Builds the QuenchingTransform of every nucleus of WS, for spectra with
+/// the binning of recoilSpectra (as given by GetRecoilSpectra()).
+inline std::map<std::string, QuenchingTransform> buildQuenchingTransforms(
+    TRestWimpSensitivity& WS, const std::map<std::string, TH1D*>& recoilSpectra) {
+    WS.CalculateQuenchingFactor();
+    auto quenchingFactor = WS.GetQuenchingFactor();
+
+    std::map<std::string, QuenchingTransform> transforms;
+    for (const auto& [element, hist] : recoilSpectra) {
+        if (quenchingFactor.count(element) == 0 || !quenchingFactor[element]) {
+            std::cout << "Error: no quenching factor for " << element << std::endl;
+            continue;
+        }
+        transforms.emplace(element, QuenchingTransform(*quenchingFactor[element], *hist->GetXaxis()));
+    }
+    return transforms;
+}
+
+#endif
@@ -0,0 +1,285 @@
+#include <TF1.h>
+#include <TH1.h>
+#include <TROOT.h>
+#include <TVector2.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <tuple>
+
+#include "parallelUtils.h"
+
+/// Quality of the fit of one peak of one segment.
+struct PeakFitScore {
+    int planeID = 0;
+    int moduleID = 0;
+    int x = 0;
+    int y = 0;
+    int peak = 0;
+    bool hasFit = false;
+    double mean = 0;
+    double sigma = 0;
+    double chi2NDF = 0;
+    /// sigma / mean
+    double relSigma = 0;
+    /// |mean - median of the neighbour means| / median of the neighbour means
+    double drift = 0;
+    bool refitted = false;
+    bool failing = false;
+};
+
+/// Returns the median of values (0 if empty).
+double median(std::vector<double> values) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    const size_t n = values.size();
+    return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+/// Mean and sigma of the fits of peak in the (up to 8) segments around (x, y).
+void getNeighbourFits(TRestDataSetGainMap::Module& module, const int x, const int y, const int peak,
+                      std::vector<double>& means, std::vector<double>& sigmas) {
+    const std::string name = "g" + std::to_string(peak);
+    for (int i = x - 1; i <= x + 1; i++) {
+        for (int j = y - 1; j <= y + 1; j++) {
+            if ((i == x && j == y) || i < 0 || j < 0 || i >= (int)module.fSegSpectra.size() ||
+                j >= (int)module.fSegSpectra[i].size())
+                continue;
+            TF1* g = module.fSegSpectra[i][j]->GetFunction(name.c_str());
+            if (!g) continue;
+            means.push_back(g->GetParameter(1));
+            sigmas.push_back(std::abs(g->GetParameter(2)));
+        }
+    }
+}
+
+/// Sets the mean, sigma, chi2/ndf, sigma/mean and drift of score from the fit g (nullptr if there
+/// is none), with neighbourMean the median of the means of the neighbours.
+void setFitScore(TF1* g, const double neighbourMean, PeakFitScore& score) {
+    score.hasFit = g != nullptr;
+    if (!g) return;
+    score.mean = g->GetParameter(1);
+    score.sigma = std::abs(g->GetParameter(2));
+    score.chi2NDF = g->GetNDF() > 0 ? g->GetChisquare() / g->GetNDF() : 0;
+    score.relSigma = score.mean != 0 ? score.sigma / std::abs(score.mean) : 0;
+    score.drift = neighbourMean != 0 ? std::abs(score.mean - neighbourMean) / std::abs(neighbourMean) : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Scores the fit of every peak of every segment of module. A fit is
+/// failing if it does not exist or if its chi2/ndf, sigma/mean or drift
+/// from the neighbouring segments are above the given limits.
+/////////////////////////////////////////////////////////////////////////
+std::vector<PeakFitScore> scoreModule(TRestDataSetGainMap::Module& module, const double maxChi2NDF,
+                                      const double maxRelSigma, const double maxDrift) {
+    std::vector<PeakFitScore> scores;
+    for (size_t x = 0; x < module.fSegSpectra.size(); x++) {
+        for (size_t y = 0; y < module.fSegSpectra[x].size(); y++) {
+            for (size_t n = 0; n < module.fEnergyPeaks.size(); n++) {
+                PeakFitScore score;
+                score.planeID = module.GetPlaneId();
+                score.moduleID = module.GetModuleId();
+                score.x = x;
+                score.y = y;
+                score.peak = n;
+                std::vector<double> means, sigmas;
+                getNeighbourFits(module, x, y, n, means, sigmas);
+                setFitScore(module.fSegSpectra[x][y]->GetFunction(("g" + std::to_string(n)).c_str()), median(means),
+                            score);
+                score.failing = !score.hasFit || score.chi2NDF > maxChi2NDF || score.relSigma > maxRelSigma ||
+                                score.drift > maxDrift;
+                scores.push_back(score);
+            }
+        }
+    }
+    return scores;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Sets range to the refit range of the peak of score: mean +- 2 sigma,
+/// with mean and sigma the medians of the fits of the same peak in the
+/// neighbouring segments. Returns false if no neighbour has a fit of that
+/// peak.
+/////////////////////////////////////////////////////////////////////////
+bool getRefitRange(TRestDataSetGainMap::Module& module, const PeakFitScore& score, TVector2& range) {
+    std::vector<double> means, sigmas;
+    getNeighbourFits(module, score.x, score.y, score.peak, means, sigmas);
+    if (means.empty()) return false;
+    const double mean = median(means);
+    const double sigma = median(sigmas);
+    range.Set(mean - 2 * sigma, mean + 2 * sigma);
+    return true;
+}
+
+/// Refit of one failing peak fit, with the original fit to restore if the refit is worse.
+struct PeakRefit {
+    PeakFitScore score;
+    TVector2 range;
+    /// Median of the means of the original fits of the neighbours (for the drift of the refit)
+    double neighbourMean = 0;
+    std::unique_ptr<TF1> original;
+    bool kept = false;
+};
+
+/// Whether the refit scored refitScore is kept instead of the original fit scored originalScore:
+/// it must exist and none of its chi2/ndf, sigma/mean and drift can be worse.
+bool isRefitBetter(const PeakFitScore& refitScore, const PeakFitScore& originalScore) {
+    if (!refitScore.hasFit) return false;
+    if (!originalScore.hasFit) return true;
+    return refitScore.chi2NDF <= originalScore.chi2NDF && refitScore.relSigma <= originalScore.relSigma &&
+           refitScore.drift <= originalScore.drift;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// This macro checks and corrects, without any user interaction, the
+/// peak fits of a gain map (see refitGainMap.cxx for the interactive
+/// version).
+///
+/// Every peak fit of every segment is scored (see scoreModule()) and the
+/// failing ones are refitted seeded from their neighbouring segments (see
+/// getRefitRange()). The refits of different segments run in
+/// parallel. A refit is only kept if none of its chi2/ndf, sigma/mean and
+/// drift is worse than the ones of the original fit, which is restored
+/// otherwise (see isRefitBetter()). Afterwards the calibration curves of
+/// the segments with refits kept are updated. The fits are scored again and the corrected gain map is
+/// exported to outputFileName, together with a report (one line per peak
+/// fit) in reportFileName. The segments still failing can be reviewed
+/// with refitGainMap(outputFileName, reportFileName).
+///
+/// ### Parameters
+/// * **gainMapFile**: file with the TRestDataSetGainMap to check.
+/// * **outputFileName**: file to export the corrected gain map to. If
+/// empty, gainMapFile with the suffix "_autoRefit".
+/// * **reportFileName**: file to write the report to. If empty,
+/// outputFileName with the extension ".txt".
+/// * **maxChi2NDF**: maximum chi2/ndf of a good fit.
+/// * **maxRelSigma**: maximum sigma/mean of a good fit.
+/// * **maxDrift**: maximum relative difference between the mean of a
+/// good fit and the median of the means of its neighbours.
+/// * **nThreads**: number of threads used for the refits (0 uses all the
+/// hardware threads).
+///
+/// \author: Álvaro Ezquerro aezquerro@unizar.es
+/////////////////////////////////////////////////////////////////////////
+
+void autoRefitGainMap(const std::string& gainMapFile, std::string outputFileName = "",
+                      std::string reportFileName = "", const double maxChi2NDF = 5,
+                      const double maxRelSigma = 0.5, const double maxDrift = 0.2, const int nThreads = 0) {
+    if (!TRestTools::fileExists(gainMapFile)) {
+        std::cout << "Error: file " << gainMapFile << " does not exist" << std::endl;
+        return;
+    }
+    if (outputFileName.empty())
+        outputFileName = gainMapFile.substr(0, gainMapFile.find_last_of(".")) + "_autoRefit." +
+                         TRestTools::GetFileNameExtension(gainMapFile);
+    if (reportFileName.empty()) reportFileName = outputFileName.substr(0, outputFileName.find_last_of(".")) + ".txt";
+
+    TRestDataSetGainMap gm;
+    gm.Import(gainMapFile);
+
+    std::vector<TRestDataSetGainMap::Module*> modules;
+    for (auto planeID : gm.GetPlaneIDs())
+        for (auto moduleID : gm.GetModuleIDs(planeID)) modules.push_back(gm.GetModule(planeID, moduleID));
+
+    // Failing fits, grouped by segment so each histogram is refitted by a single thread
+    std::vector<PeakFitScore> scores;
+    std::map<std::tuple<size_t, int, int>, std::vector<PeakFitScore>> failingSegments;
+    for (size_t i = 0; i < modules.size(); i++) {
+        for (const auto& score : scoreModule(*modules[i], maxChi2NDF, maxRelSigma, maxDrift)) {
+            scores.push_back(score);
+            if (score.failing) failingSegments[{i, score.x, score.y}].push_back(score);
+        }
+    }
+    std::cout << "Failing peak fits: "
+              << std::count_if(scores.begin(), scores.end(), [](const PeakFitScore& s) { return s.failing; })
+              << " of " << scores.size() << " in " << failingSegments.size() << " segments" << std::endl;
+
+    ROOT::EnableThreadSafety();
+    TH1::AddDirectory(false);
+    ThreadSafeMinimizer minimizer;  // TMinuit is not thread safe
+
+    // The ranges are seeded from the original fits of the neighbours, before any of them is refitted,
+    // and the original fits are copied (serially) to restore them if the refit is worse
+    std::vector<std::tuple<size_t, int, int>> segments;
+    std::vector<std::vector<PeakRefit>> refits;
+    for (const auto& [segment, failing] : failingSegments) {
+        const auto& [i, x, y] = segment;
+        segments.push_back(segment);
+        refits.emplace_back();
+        for (const auto& score : failing) {
+            PeakRefit refit;
+            if (!getRefitRange(*modules[i], score, refit.range)) continue;
+            std::vector<double> means, sigmas;
+            getNeighbourFits(*modules[i], x, y, score.peak, means, sigmas);
+            refit.score = score;
+            refit.neighbourMean = median(means);
+            TF1* g = modules[i]->fSegSpectra[x][y]->GetFunction(("g" + std::to_string(score.peak)).c_str());
+            if (g) refit.original.reset((TF1*)g->Clone());
+            refits.back().push_back(std::move(refit));
+        }
+    }
+
+    parallelFor(segments.size(), resolveNumberOfThreads(nThreads), [&](size_t s, unsigned int) {
+        const auto& [i, x, y] = segments[s];
+        for (const auto& refit : refits[s]) modules[i]->Refit(x, y, refit.score.peak, refit.range);
+    });
+
+    // Keep the refits that are not worse, restore the original fits of the others and update the
+    // calibration curves of the segments with refits kept (serially)
+    std::set<std::tuple<int, int, int, int, int>> refittedPeaks;
+    size_t nRejected = 0;
+    for (size_t s = 0; s < segments.size(); s++) {
+        const auto& [i, x, y] = segments[s];
+        TH1* hist = modules[i]->fSegSpectra[x][y];
+        bool anyKept = false;
+        for (auto& refit : refits[s]) {
+            const std::string name = "g" + std::to_string(refit.score.peak);
+            PeakFitScore refitScore;
+            setFitScore(hist->GetFunction(name.c_str()), refit.neighbourMean, refitScore);
+            refit.kept = isRefitBetter(refitScore, refit.score);
+            if (refit.kept) {
+                anyKept = true;
+                refittedPeaks.insert({modules[i]->GetPlaneId(), modules[i]->GetModuleId(), x, y, refit.score.peak});
+                continue;
+            }
+            nRejected++;
+            while (TF1* g = hist->GetFunction(name.c_str())) {
+                hist->GetListOfFunctions()->Remove(g);
+                delete g;
+            }
+            if (refit.original) hist->GetListOfFunctions()->Add(refit.original.release());
+        }
+        if (anyKept) modules[i]->UpdateCalibrationFits(x, y);
+    }
+
+    // Score again and write the report
+    std::ofstream report(reportFileName);
+    report << "# Gain map " << gainMapFile << " refitted to " << outputFileName << std::endl;
+    report << "# Limits: chi2/ndf " << maxChi2NDF << ", sigma/mean " << maxRelSigma << ", drift " << maxDrift
+           << std::endl;
+    report << "# planeID\tmoduleID\tx\ty\tpeak\thasFit\tmean\tsigma\tchi2NDF\trelSigma\tdrift\trefitted\tfailing"
+           << std::endl;
+    size_t nFailing = 0;
+    for (auto module : modules) {
+        for (auto score : scoreModule(*module, maxChi2NDF, maxRelSigma, maxDrift)) {
+            score.refitted = refittedPeaks.count({score.planeID, score.moduleID, score.x, score.y, score.peak});
+            nFailing += score.failing;
+            report << score.planeID << "\t" << score.moduleID << "\t" << score.x << "\t" << score.y << "\t"
+                   << score.peak << "\t" << score.hasFit << "\t" << score.mean << "\t" << score.sigma << "\t"
+                   << score.chi2NDF << "\t" << score.relSigma << "\t" << score.drift << "\t" << score.refitted
+                   << "\t" << score.failing << std::endl;
+        }
+    }
+    report.close();
+
+    gm.Export(outputFileName);
+    std::cout << "Refitted " << refittedPeaks.size() << " peak fits (" << nRejected
+              << " refits worse than the original fit were discarded). Still failing: " << nFailing << " peak fits"
+              << std::endl;
+    std::cout << "Gain map exported to " << outputFileName << ", report written to " << reportFileName
+              << std::endl;
+}
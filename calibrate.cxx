@@ -1,3 +1,356 @@
+#include <TBufferJSON.h>
+#include <TChain.h>
+#include <TDataMember.h>
+#include <TFile.h>
+#include <TNamed.h>
+#include <TH1.h>
+#include <TMD5.h>
+#include <TROOT.h>
+#include <TSystem.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+
+#include "parallelUtils.h"
+#include "runCatalog.h"
+#include "stageProfiler.h"
+
+/////////////////////////////////////////////////////////////////////////
+/// Returns the (plane, module) IDs of all the modules of cal.
+/////////////////////////////////////////////////////////////////////////
+std::vector<std::pair<int, int>> getModuleIDs(TRestDataSetGainMap& cal) {
+    std::vector<std::pair<int, int>> moduleIDs;
+    for (auto planeID : cal.GetPlaneIDs())
+        for (auto moduleID : cal.GetModuleIDs(planeID)) moduleIDs.emplace_back(planeID, moduleID);
+    return moduleIDs;
+}
+
+/// Context of the stages of a module in the stage profile.
+std::string getModuleContext(TRestDataSetGainMap& cal, const int planeID, const int moduleID) {
+    return (std::string)cal.GetName() + " plane " + std::to_string(planeID) + " module " + std::to_string(moduleID);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Threaded version of TRestDataSetGainMap::GenerateGainMap(). The gain
+/// maps of the modules (filling the spectra of their segments and fitting
+/// the peaks and the calibration curves) are generated concurrently by
+/// nThreads workers (0 uses all the hardware threads). Each module runs
+/// TRestDataSetGainMap::Module::GenerateGainMap(), i.e. the same code as
+/// the serial path, and a module is the smallest independent unit that
+/// the class exposes (its segments are fitted inside that method).
+///
+/// The fits need a thread safe minimizer: if the default one is TMinuit,
+/// Minuit2 is used while the gain map is generated (see
+/// ThreadSafeMinimizer) and the results may differ slightly from the
+/// serial path, which keeps TMinuit. With a thread safe default minimizer
+/// (e.g. Minuit2 set in the rootrc) both paths give the same results.
+///
+/// If moduleIDs is given, only those modules are generated. If profiler
+/// is given, the generation of each module is recorded as a stage.
+/////////////////////////////////////////////////////////////////////////
+void generateGainMapParallel(TRestDataSetGainMap& cal, const int nThreads,
+                             std::vector<std::pair<int, int>> moduleIDs = {}, StageProfiler* profiler = nullptr) {
+    if (moduleIDs.empty()) moduleIDs = getModuleIDs(cal);
+
+    ROOT::EnableThreadSafety();
+    TH1::AddDirectory(false);
+    ThreadSafeMinimizer minimizer;
+    if (minimizer.Changed())
+        std::cout << "\tWarning: TMinuit is not thread safe. Using Minuit2 to generate the gain map." << std::endl;
+
+    const unsigned int nWorkers =
+        std::min(resolveNumberOfThreads(nThreads), (unsigned int) std::max<size_t>(1, moduleIDs.size()));
+    const std::thread::id outputOwner = outputOwnerThread();
+    auto busyTime = parallelFor(moduleIDs.size(), nWorkers, [&](size_t i, unsigned int) {
+        OutputOwnerScope output(outputOwner);  // with the output of the calling thread (e.g. of its rml file)
+        std::cout << "\tGenerating gain map of plane " << moduleIDs[i].first << " module " << moduleIDs[i].second
+                  << std::endl;
+        StageProfiler::Scope stage(profiler, "GenerateGainMap",
+                                   getModuleContext(cal, moduleIDs[i].first, moduleIDs[i].second));
+        cal.GetModule(moduleIDs[i].first, moduleIDs[i].second)->GenerateGainMap();
+    });
+    for (size_t t = 0; t < busyTime.size(); t++)
+        std::cout << "\tThread " << t << ": busy " << busyTime[t] << "[ms]" << std::endl;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Returns the configuration of cal at the gain map level: the JSON of all
+/// its persistent data members (observables, cut, file names...) but the
+/// modules, one per line. New data members of TRestDataSetGainMap are
+/// included without changing this function.
+/////////////////////////////////////////////////////////////////////////
+std::string getGainMapConfig(TRestDataSetGainMap& cal) {
+    std::string config;
+    for (auto obj : *TRestDataSetGainMap::Class()->GetListOfDataMembers()) {
+        auto member = (TDataMember*)obj;
+        if (!member->IsPersistent() || ((std::string)member->GetTypeName()).find("Module") != std::string::npos)
+            continue;
+        config += (std::string)member->GetName() + " " +
+                  TBufferJSON::ConvertToJSON((char*)&cal + member->GetOffset(), member).Data() + "\n";
+    }
+    return config;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Returns the MD5 hash identifying the calibration of a module: the
+/// parameters of the module and the rest of the configuration of cal (see
+/// getGainMapConfig()), as defined in the rml, so it must be called before
+/// generating the gain map, and the name, size and modification time of
+/// the data set used to calibrate it. The content of the data set is not
+/// read, so a file rewritten with the same size and modification time is
+/// not detected.
+/////////////////////////////////////////////////////////////////////////
+std::string getModuleHash(TRestDataSetGainMap& cal, const int planeID, const int moduleID) {
+    auto module = cal.GetModule(planeID, moduleID);
+    std::string dataSetFileName = module->GetDataSetFileName();
+    if (dataSetFileName.empty()) dataSetFileName = cal.GetCalibrationFileName();
+
+    FileStat_t fileStat;
+    if (gSystem->GetPathInfo(dataSetFileName.c_str(), fileStat) != 0) {
+        fileStat.fSize = -1;
+        fileStat.fMtime = -1;
+    }
+
+    const std::string key = getGainMapConfig(cal) + dataSetFileName + "\n" +
+                            std::to_string(fileStat.fSize) + "\n" + std::to_string(fileStat.fMtime) + "\n" +
+                            TBufferJSON::ToJSON(module).Data();
+    TMD5 md5;
+    md5.Update((const UChar_t*)key.data(), key.size());
+    md5.Final();
+    return md5.AsString();
+}
+
+/// Name of the TNamed storing the hash of a module in the gain map file.
+std::string getModuleHashName(const int planeID, const int moduleID) {
+    return "gainMapHash_" + std::to_string(planeID) + "_" + std::to_string(moduleID);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Loads the calibration parameters of cal from its outputFileName if the
+/// file exists and it was generated with the same parameters and input
+/// files (see getModuleHash(), the hash of each module is stored in the
+/// file). Otherwise it calculates them (with generateGainMapParallel()
+/// if nFitThreads is not 1) and exports them to that file.
+///
+/// If only some modules changed, only those are generated again and the
+/// calibration of the rest is taken from the existing file. In that case
+/// cal is imported from the exported file at the end, so none of its
+/// modules depends on the temporary gain map read from the old file.
+///
+/// If profiler is given, the Import, the generation of each module and
+/// the Export are recorded as stages.
+/////////////////////////////////////////////////////////////////////////
+void loadOrGenerateGainMap(TRestDataSetGainMap& cal, const int nFitThreads = 1,
+                           StageProfiler* profiler = nullptr) {
+    const std::string fileName = cal.GetOutputFileName();
+    const auto moduleIDs = getModuleIDs(cal);
+    std::map<std::pair<int, int>, std::string> hashes;
+    for (const auto& [planeID, moduleID] : moduleIDs) hashes[{planeID, moduleID}] = getModuleHash(cal, planeID, moduleID);
+
+    // Modules whose stored hash does not match
+    std::vector<std::pair<int, int>> outdated = moduleIDs;
+    if ( TRestTools::fileExists(fileName) ) {
+        outdated.clear();
+        std::unique_ptr<TFile> f(TFile::Open(fileName.c_str()));
+        for (const auto& [ids, hash] : hashes) {
+            auto storedHash = f ? f->Get<TNamed>(getModuleHashName(ids.first, ids.second).c_str()) : nullptr;
+            if (!storedHash || storedHash->GetTitle() != hash) outdated.push_back(ids);
+        }
+    }
+
+    if ( outdated.empty() ) {
+        std::cout << "\tLoading calibration from " << fileName << std::endl;
+        StageProfiler::Scope stage(profiler, "Import", cal.GetName());
+        cal.Import(fileName);
+        return;
+    }
+
+    cal.SetVerboseLevel( (TRestStringOutput::REST_Verbose_Level) 1); //0:essential 1: warnings, 2: info, 3: debug
+    // It must live until the gain map is exported, as the modules reused from it point to it (cal is
+    // imported again from the exported file at the end)
+    TRestDataSetGainMap previous;
+    if ( outdated.size() < moduleIDs.size() ) {
+        std::cout << "\t" << fileName << " is outdated for " << outdated.size() << " of " << moduleIDs.size()
+                  << " modules. Reusing the calibration of the rest." << std::endl;
+        StageProfiler::Scope stage(profiler, "Import", cal.GetName());
+        previous.Import(fileName);
+        for (const auto& [planeID, moduleID] : moduleIDs) {
+            if (std::find(outdated.begin(), outdated.end(), std::make_pair(planeID, moduleID)) != outdated.end())
+                continue;
+            cal.SetModuleCalibration(*previous.GetModule(planeID, moduleID));
+        }
+    } else if ( TRestTools::fileExists(fileName) ) {
+        std::cout << "\t" << fileName << " is outdated. Generating the gain map again." << std::endl;
+    }
+
+    // When profiling, the modules are generated one by one (as GenerateGainMap does) to record each of them
+    if (nFitThreads != 1)
+        generateGainMapParallel(cal, nFitThreads, outdated, profiler);
+    else if (outdated.size() < moduleIDs.size() || profiler)
+        for (const auto& [planeID, moduleID] : outdated) {
+            StageProfiler::Scope stage(profiler, "GenerateGainMap", getModuleContext(cal, planeID, moduleID));
+            cal.GetModule(planeID, moduleID)->GenerateGainMap();
+        }
+    else
+        cal.GenerateGainMap();
+    {
+        StageProfiler::Scope stage(profiler, "Export", cal.GetName());
+        cal.Export();
+    }
+
+    std::unique_ptr<TFile> f(TFile::Open(fileName.c_str(), "UPDATE"));
+    if (f && !f->IsZombie()) {
+        for (const auto& [ids, hash] : hashes)
+            TNamed(getModuleHashName(ids.first, ids.second).c_str(), hash.c_str())
+                .Write(getModuleHashName(ids.first, ids.second).c_str(), TObject::kOverwrite);
+        f->Close();
+        std::cout << "\tExported calibration file to " << fileName << std::endl;
+    } else {
+        // Without the hashes the gain map is generated again next time
+        std::cout << "Error: cannot open " << fileName << " to write the module hashes" << std::endl;
+    }
+
+    // The modules reused from previous still point to it
+    if ( outdated.size() < moduleIDs.size() ) {
+        StageProfiler::Scope stage(profiler, "Import", cal.GetName());
+        cal.Import(fileName);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Calibrates dataSetFileName with all the gainMaps reading and writing
+/// the data set only once. As TRestDataSetGainMap::CalibrateDataSet(),
+/// for each gain map it defines the columns {name}_pmID (planeID * 10 +
+/// moduleID of the module whose definition cut is passed by the event, -1
+/// if none) and {name}_{observable} (calibrated energy, with observable
+/// the one of the gain map without the process prefix, e.g.
+/// ThresholdIntegral for rawAna_ThresholdIntegral, NaN if no module
+/// matches). All the gain maps are saved to the output file too.
+///
+/// If friendOutput is true, instead of a full copy of the data set only
+/// the new columns, plus the entry number of the data set (column
+/// "entry"), are written to the TTree "CalibrationFriend". It must be used
+/// as a friend of the data set (see getCalibratedDataSet()), so the data
+/// set is read without implicit multithreading (restored afterwards) to
+/// keep the order of the entries.
+///
+/// If outputFileName is empty, it is dataSetFileName with the suffix "_cc"
+/// (or "_calFriend" for the friend output).
+/////////////////////////////////////////////////////////////////////////
+void calibrateDataSetSinglePass(const std::vector<TRestDataSetGainMap*>& gainMaps,
+                                const std::string& dataSetFileName, std::string outputFileName = "",
+                                const bool friendOutput = false) {
+    std::unique_ptr<ImplicitMTDisabled> sequential(friendOutput ? new ImplicitMTDisabled() : nullptr);
+    TRestDataSet dataSet;
+    dataSet.EnableMultiThreading(!friendOutput);
+    dataSet.Import(dataSetFileName);
+    ROOT::RDF::RNode dataFrame = dataSet.GetDataFrame();
+
+    std::set<std::string> definedColumns;
+    for (const auto& column : dataFrame.GetColumnNames()) definedColumns.insert(column);
+    std::vector<std::string> newColumns;
+    auto defineOrRedefine = [&](const std::string& name, auto&&... args) {
+        if (definedColumns.count(name))
+            dataFrame = dataFrame.Redefine(name, args...);
+        else
+            dataFrame = dataFrame.Define(name, args...);
+        definedColumns.insert(name);
+    };
+
+    for (auto* gainMap : gainMaps) {
+        // The last module whose definition cut is passed has priority (as in CalibrateDataSet)
+        const std::string pmIDName = (std::string)gainMap->GetName() + "_pmID";
+        std::string pmIDExpression = "-1";
+        for (const auto planeID : gainMap->GetPlaneIDs()) {
+            for (const auto moduleID : gainMap->GetModuleIDs(planeID)) {
+                auto module = gainMap->GetModule(planeID, moduleID);
+                pmIDExpression = "(" + module->GetModuleDefinitionCut() + ") ? " +
+                                 std::to_string(planeID * 10 + moduleID) + " : (" + pmIDExpression + ")";
+            }
+        }
+        defineOrRedefine(pmIDName, pmIDExpression);
+        newColumns.push_back(pmIDName);
+
+        auto calibratedEnergy = [gainMap](const int pmID, const double x, const double y, const double energy) {
+            if (pmID < 0) return std::numeric_limits<double>::quiet_NaN();
+            return gainMap->GetSlopeParameter(pmID / 10, pmID % 10, x, y) * energy +
+                   gainMap->GetInterceptParameter(pmID / 10, pmID % 10, x, y);
+        };
+        std::string observable = gainMap->GetObservable();
+        const std::string calibratedName =
+            (std::string)gainMap->GetName() + "_" + observable.erase(0, observable.find("_") + 1);
+        defineOrRedefine(calibratedName, calibratedEnergy,
+                         std::vector<std::string>{pmIDName, gainMap->GetSpatialObservableX(),
+                                                  gainMap->GetSpatialObservableY(), gainMap->GetObservable()});
+        newColumns.push_back(calibratedName);
+        std::cout << "\tCalibrated column " << calibratedName << " from " << gainMap->GetName() << std::endl;
+    }
+
+    if (outputFileName.empty())
+        outputFileName = dataSetFileName.substr(0, dataSetFileName.find_last_of(".")) +
+                         (friendOutput ? "_calFriend." : "_cc.") + TRestTools::GetFileNameExtension(dataSetFileName);
+
+    if (friendOutput) {
+        dataFrame = dataFrame.Define("entry", "rdfentry_");
+        newColumns.push_back("entry");
+        dataFrame.Snapshot("CalibrationFriend", outputFileName, newColumns);
+    } else {
+        dataSet.SetDataFrame(dataFrame);
+        dataSet.Export(outputFileName);
+    }
+
+    std::unique_ptr<TFile> f(TFile::Open(outputFileName.c_str(), "UPDATE"));
+    if (!f || f->IsZombie()) {
+        std::cout << "Error: cannot open " << outputFileName << " to write the gain maps" << std::endl;
+        return;
+    }
+    for (auto* gainMap : gainMaps) gainMap->Write();
+    if (friendOutput) TNamed("dataSetFileName", dataSetFileName.c_str()).Write();
+    f->Close();
+    std::cout << "Calibrated data set (" << gainMaps.size() << " gain maps) exported to " << outputFileName
+              << std::endl;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Returns the data set tree of dataSetFileName with the calibrated
+/// columns of friendFileName (written by calibrateDataSetSinglePass() with
+/// friendOutput = true) attached as the friend "calibration", e.g.
+/// ROOT::RDataFrame df(*getCalibratedDataSet(dataSet, friendFile)).
+/// The friend entries are matched through an index on its "entry" column
+/// (the alias "entry" of the data set tree is its entry number, Entry$).
+/// Returns nullptr if the number of entries does not match or the index
+/// cannot be built.
+/////////////////////////////////////////////////////////////////////////
+TChain* getCalibratedDataSet(const std::string& dataSetFileName, const std::string& friendFileName) {
+    TChain* dataSetTree = new TChain("AnalysisTree");
+    dataSetTree->Add(dataSetFileName.c_str());
+    TChain* friendTree = new TChain("CalibrationFriend");
+    friendTree->Add(friendFileName.c_str());
+
+    if (dataSetTree->GetEntries() != friendTree->GetEntries()) {
+        std::cout << "Error: " << friendFileName << " has " << friendTree->GetEntries() << " entries but "
+                  << dataSetFileName << " has " << dataSetTree->GetEntries() << std::endl;
+        delete dataSetTree;
+        delete friendTree;
+        return nullptr;
+    }
+    friendTree->BuildIndex("entry");
+    if (!friendTree->GetTreeIndex()) {
+        std::cout << "Error: cannot build the index of " << friendFileName << " on its entry column" << std::endl;
+        delete dataSetTree;
+        delete friendTree;
+        return nullptr;
+    }
+    dataSetTree->SetAlias("entry", "Entry$");
+    dataSetTree->AddFriend(friendTree, "calibration");
+    return dataSetTree;
+}
+
 /////////////////////////////////////////////////////////////////////////
 /// This macro performs multiple calibrations (following the parameters 
 /// of the set rmlFiles) of a single dataSet file (dataSetToCalibrate).
@@ -5,8 +358,10 @@
 /// For each rml file (following rmlFile pattern) it will calculate the
 /// calibration parameters and export them to outputFileName (given
 /// at the rml file as a paremeter of the TRestDataSetGainMap). This 
-/// is done unless a file with outputFileName already exists, in which
-/// case it will import the calibration parameters from that file.
+/// is done unless a file with outputFileName already exists and it was
+/// generated with the same parameters and input files, in which case it
+/// will import the calibration parameters from that file (only the
+/// modules that changed are calculated again, see loadOrGenerateGainMap()).
 ///
 /// If dataSetToCalibrate is empty, it will only calculate (or load)
 /// the calibration parameters following the rml parameters.
@@ -16,37 +371,137 @@
 /// the TRestDataSetGainMap class definition. (See 
 /// TRestTools::GetFilesMatchingPattern() ).
 /// * **dataSetToCalibrate**: name of the file to be calibrated.
+/// * **nParallelFiles**: number of rml files whose calibration parameters
+/// are calculated (or loaded) at the same time (0 uses all the hardware
+/// threads). If more than one, the gain maps are fitted with a thread safe
+/// minimizer (see ThreadSafeMinimizer). The output of every file is
+/// printed at once when it finishes, and a summary with the time spent on each file is printed at
+/// the end. The calibration of dataSetToCalibrate is always done one gain
+/// map after another, as they all write the same output file.
+/// * **singlePass**: if true, dataSetToCalibrate is calibrated with all the
+/// gain maps at once (see calibrateDataSetSinglePass()): the data set is
+/// read once and a single output file with one calibrated energy column
+/// per gain map is written.
+/// * **friendOutput**: if true, only the calibrated columns are written,
+/// to a small friend tree of dataSetToCalibrate (see
+/// calibrateDataSetSinglePass() and getCalibratedDataSet()). It implies
+/// singlePass.
+/// * **nFitThreads**: number of threads used to generate each gain map
+/// (see generateGainMapParallel()). 1 uses the serial
+/// TRestDataSetGainMap::GenerateGainMap().
+/// * **useCatalog**: if true, dataSetToCalibrate is checked to have entries
+/// in its AnalysisTree using the run catalog of its directory (see
+/// runCatalog.h, it is written there), without opening it if it is already
+/// catalogued. Its number of entries for profileOutput is taken from the
+/// catalog too. It only saves that check: the calibration reads the file.
+/// * **profileOutput**: if not empty, the wall and CPU time, peak memory,
+/// bytes read and written and entries of every stage (rml parsing,
+/// Import, GenerateGainMap of each module, Export and the calibration of
+/// dataSetToCalibrate) are appended to this file (see stageProfiler.h):
+/// a TTree if it is a .root file, JSON lines otherwise.
 ///
 /// \author: Álvaro Ezquerro aezquerro@unizar.es
 /////////////////////////////////////////////////////////////////////////
 
-void calibrate(const std::string& rmlFile, const std::string& dataSetToCalibrate = "") {
+void calibrate(const std::string& rmlFile, const std::string& dataSetToCalibrate = "",
+               const int nParallelFiles = 1, const bool singlePass = false,
+               const bool friendOutput = false, const int nFitThreads = 1, const bool useCatalog = false,
+               const std::string& profileOutput = "") {
 
     if ( !dataSetToCalibrate.empty() && !TRestTools::fileExists(dataSetToCalibrate) ){
         std::cout << "File " << dataSetToCalibrate << " does not exist" << std::endl;
         return;
     }
-    /*else if ( !TRestTools::isDataSet(dataSetToCalibrate)) { 
-        std::cout << "File " << dataSetToCalibrate << " is not a data set" << std::endl;
-        return;
-    }//*/ //it may not be needed to be a TRestDataSet as it may function as well with TRestAnalysisTree
+    // It may not be a TRestDataSet (it works as well with a TRestAnalysisTree), but it needs entries to calibrate
+    Long64_t dataSetEntries = -1;
+    if ( !dataSetToCalibrate.empty() && useCatalog ) {
+        const auto entry = getRunCatalog({dataSetToCalibrate}).at(dataSetToCalibrate);
+        if ( !entry.fHasAnalysisTree || entry.fEntries == 0 ) {
+            std::cout << "File " << dataSetToCalibrate << " has no entries in AnalysisTree" << std::endl;
+            return;
+        }
+        dataSetEntries = entry.fEntries;
+    }
+
+    std::unique_ptr<StageProfiler> profiler(profileOutput.empty() ? nullptr : new StageProfiler("calibrate"));
+    if ( profiler && !dataSetToCalibrate.empty() && dataSetEntries < 0 ) {
+        dataSetEntries = 0;
+        std::unique_ptr<TFile> f(TFile::Open(dataSetToCalibrate.c_str()));
+        TTree* tree = f ? f->Get<TTree>("AnalysisTree") : nullptr;
+        if (tree) dataSetEntries = tree->GetEntries();
+    }
 
     std::vector<std::string> fileSelection = TRestTools::GetFilesMatchingPattern(rmlFile);
-    for (auto& file : fileSelection) {
-        std::cout << "TRestDataSetGainMap parameters loaded from " << file << std::endl;
-
-        TRestDataSetGainMap cal(file.c_str());
-        if ( TRestTools::fileExists( cal.GetOutputFileName() ) ) {
-            std::cout << "\tLoading calibration from " << cal.GetOutputFileName() << std::endl;
-            cal.Import(cal.GetOutputFileName());
-        } else {
-            cal.SetVerboseLevel( (TRestStringOutput::REST_Verbose_Level) 1); //0:essential 1: warnings, 2: info, 3: debug
-            cal.GenerateGainMap();
-            cal.Export();
-            std::cout << "\tExported calibration file to " << cal.GetOutputFileName() << std::endl;
-        }
-        if ( !dataSetToCalibrate.empty() )
-            cal.CalibrateDataSet(dataSetToCalibrate);
-    }
-        
-}
\ No newline at end of file
+    const unsigned int nWorkers =
+        std::min(resolveNumberOfThreads(nParallelFiles), (unsigned int) std::max<size_t>(1, fileSelection.size()));
+    if (nWorkers > 1) {
+        ROOT::EnableThreadSafety();
+        TH1::AddDirectory(false); // each gain map creates its own histograms, with the same names
+    }
+
+    // Gain maps (one per rml file), generated or loaded concurrently
+    std::vector<std::unique_ptr<TRestDataSetGainMap>> gainMaps(fileSelection.size());
+    std::vector<double> gainMapTime(fileSelection.size(), 0), calibrationTime(fileSelection.size(), 0);
+    {
+        // The gain maps of different files are fitted at the same time, and TMinuit is not thread safe
+        std::unique_ptr<ThreadSafeMinimizer> minimizer(nWorkers > 1 ? new ThreadSafeMinimizer() : nullptr);
+        if (minimizer && minimizer->Changed())
+            std::cout << "Warning: TMinuit is not thread safe. Using Minuit2 to generate the gain maps." << std::endl;
+        std::unique_ptr<BufferedCout> log(nWorkers > 1 ? new BufferedCout() : nullptr);
+        parallelFor(fileSelection.size(), nWorkers, [&](size_t i, unsigned int) {
+            auto begin = std::chrono::steady_clock::now();
+            std::cout << "TRestDataSetGainMap parameters loaded from " << fileSelection[i] << std::endl;
+            {
+                std::lock_guard<std::mutex> lock(restConfigMutex());
+                StageProfiler::Scope stage(profiler.get(), "TRestDataSetGainMap (rml)", fileSelection[i]);
+                gainMaps[i].reset(new TRestDataSetGainMap(fileSelection[i].c_str()));
+            }
+            loadOrGenerateGainMap(*gainMaps[i], nFitThreads, profiler.get());
+            auto end = std::chrono::steady_clock::now();
+            gainMapTime[i] = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
+            if (log) log->Flush();
+        });
+    }
+
+    if ( !dataSetToCalibrate.empty() && (singlePass || friendOutput) ) {
+        std::vector<TRestDataSetGainMap*> gainMapList;
+        for (auto& gainMap : gainMaps) gainMapList.push_back(gainMap.get());
+        auto begin = std::chrono::steady_clock::now();
+        {
+            StageProfiler::Scope stage(profiler.get(), "calibrateDataSetSinglePass", dataSetToCalibrate);
+            stage.SetEntries(dataSetEntries);
+            calibrateDataSetSinglePass(gainMapList, dataSetToCalibrate, "", friendOutput);
+        }
+        auto end = std::chrono::steady_clock::now();
+        std::cout << "Single pass calibration: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "[ms]"
+                  << std::endl;
+    }
+    // All the calibrations write to the same output file by default, so they go one after another
+    else if ( !dataSetToCalibrate.empty() ) {
+        for (size_t i = 0; i < gainMaps.size(); i++) {
+            auto begin = std::chrono::steady_clock::now();
+            {
+                StageProfiler::Scope stage(profiler.get(), "CalibrateDataSet", gainMaps[i]->GetName());
+                stage.SetEntries(dataSetEntries);
+                gainMaps[i]->CalibrateDataSet(dataSetToCalibrate);
+            }
+            auto end = std::chrono::steady_clock::now();
+            calibrationTime[i] = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
+        }
+    }
+
+    if (nWorkers > 1) {
+        std::cout << "Summary (" << nWorkers << " files in parallel):" << std::endl;
+        for (size_t i = 0; i < fileSelection.size(); i++) {
+            std::cout << "\t" << fileSelection[i] << ": gain map " << gainMapTime[i] << "[ms]";
+            if (!dataSetToCalibrate.empty() && !singlePass && !friendOutput) std::cout << ", calibration " << calibrationTime[i] << "[ms]";
+            std::cout << std::endl;
+        }
+    }
+
+    if (profiler) {
+        profiler->Print();
+        profiler->Write(profileOutput);
+    }
+}
@@ -1,3 +1,196 @@
+#include <TFile.h>
+#include <TKey.h>
+#include <TMD5.h>
+#include <TNamed.h>
+#include <TROOT.h>
+#include <TSystem.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <future>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+
+#include "parallelUtils.h"
+
+/// Name of the TNamed of the output file with the checksums of the objects copied to it.
+#define COPY_OBJECTS_REGISTRY "copyObjectsRegistry"
+
+/////////////////////////////////////////////////////////////////////////
+/// Returns the MD5 checksum of the name, class and (compressed) payload of
+/// key, read as raw bytes from its file. Identical objects written with
+/// the same name and compression settings have the same checksum. The
+/// name is included because the payload of many classes (TVectorD,
+/// TObjString, std::vector...) does not contain it.
+/////////////////////////////////////////////////////////////////////////
+std::string getKeyChecksum(TKey* key) {
+    TFile* file = key->GetFile();
+    const Int_t length = key->GetNbytes() - key->GetKeylen();
+    std::vector<char> buffer(std::max(0, length));
+    if (!file || length <= 0 || file->ReadBuffer(buffer.data(), key->GetSeekKey() + key->GetKeylen(), length))
+        return "";
+    const std::string header = (std::string)key->GetName() + "\n" + key->GetClassName() + "\n";
+    TMD5 md5;
+    md5.Update((const UChar_t*)header.data(), header.size());
+    md5.Update((const UChar_t*)buffer.data(), length);
+    md5.Final();
+    return md5.AsString();
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Returns the checksums of the objects already in outputFile: those of
+/// its keys (last cycle) and those stored in its registry (the objects
+/// copied by previous calls, e.g. trees that were merged).
+/////////////////////////////////////////////////////////////////////////
+std::set<std::string> getKnownChecksums(TFile& outputFile) {
+    std::set<std::string> checksums;
+    TIter nextkey(outputFile.GetListOfKeys());
+    TKey* key;
+    while ((key = (TKey*)nextkey())) {
+        if (outputFile.GetKey(key->GetName()) != key) continue;
+        checksums.insert(getKeyChecksum(key));
+    }
+    std::unique_ptr<TNamed> registry(outputFile.Get<TNamed>(COPY_OBJECTS_REGISTRY));
+    if (registry) {
+        std::istringstream lines(registry->GetTitle());
+        for (std::string line; std::getline(lines, line);)
+            if (!line.empty()) checksums.insert(line);
+    }
+    checksums.erase("");
+    return checksums;
+}
+
+/// Writes (overwriting it) the registry of checksums of outputFile.
+void writeChecksumRegistry(TFile& outputFile, const std::set<std::string>& checksums) {
+    std::string text;
+    for (const auto& checksum : checksums) text += checksum + "\n";
+    outputFile.cd();
+    TNamed(COPY_OBJECTS_REGISTRY, text.c_str()).Write(COPY_OBJECTS_REGISTRY, TObject::kOverwrite);
+}
+
+/// Deletes the older cycles of the object name in directory with the same
+/// content (checksum) as the last one, so distinct objects with the same
+/// name are kept. Only the keys are deleted (as TObject::Write with
+/// kOverwrite does), so the baskets of a TTree, shared by its cycles, are
+/// kept.
+void deleteOlderCycles(TDirectory& directory, const std::string& name) {
+    TKey* newest = directory.GetKey(name.c_str());
+    if (newest == nullptr) return;
+    const std::string checksum = getKeyChecksum(newest);
+    std::vector<TKey*> older;
+    TIter nextkey(directory.GetListOfKeys());
+    TKey* key;
+    while ((key = (TKey*)nextkey()))
+        if (name == key->GetName() && key->GetCycle() < newest->GetCycle() && getKeyChecksum(key) == checksum)
+            older.push_back(key);
+    for (auto oldKey : older) {
+        oldKey->Delete();
+        delete oldKey;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Copies the objects of inputDir into outputDir without deserialising
+/// them (the last cycle of each key, or all the cycles of the objects that
+/// are not trees nor directories if allCycles is true):
+/// * TTrees are merged by fast cloning (their baskets are copied as they
+///   are compressed): the first tree with a given path (or the one already
+///   in outputDir) receives the entries of the rest with
+///   TTree::CopyEntries(tree, -1, "fast"). outputTrees keeps them, by
+///   path, until they are written by copyObjects().
+/// * Directories are copied recursively into the directory with the same
+///   name of outputDir (created if needed).
+/// * Any other object is copied as the raw (compressed) bytes of its key.
+///   Its TProcessID offset is not changed, so objects holding TRefs to
+///   objects of other files are not supported.
+///
+/// If checksums is given, the objects whose checksum (see
+/// getKeyChecksum()) is in it are skipped, and the checksums of the
+/// copied objects are added to it.
+/////////////////////////////////////////////////////////////////////////
+void fastCopyObjects(TDirectory& inputDir, TDirectory& outputDir, std::map<std::string, TTree*>& outputTrees,
+                     std::set<std::string>* checksums = nullptr, const bool allCycles = false) {
+    // Oldest cycles first, so the copies keep their order
+    std::vector<TKey*> keys;
+    for (auto obj : *inputDir.GetListOfKeys()) keys.push_back((TKey*)obj);
+    std::stable_sort(keys.begin(), keys.end(), [](TKey* a, TKey* b) { return a->GetCycle() < b->GetCycle(); });
+    for (TKey* key : keys) {
+        if ((std::string)key->GetName() == COPY_OBJECTS_REGISTRY) continue;
+        TClass* cl = TClass::GetClass(key->GetClassName());
+        const bool isDirectory = cl && cl->InheritsFrom(TDirectory::Class());
+        const bool isTree = cl && cl->InheritsFrom(TTree::Class());
+        if ((!allCycles || isDirectory || isTree) && inputDir.GetKey(key->GetName()) != key) continue;
+        // The directories are always entered, their contents are checked one by one
+        if (checksums && !isDirectory && !checksums->insert(getKeyChecksum(key)).second) {
+            std::cout << "\t" << key->GetClassName() << "\t" << key->GetName() << " (already copied, skipped)"
+                      << std::endl;
+            continue;
+        }
+        std::cout << "\t" << key->GetClassName() << "\t" << key->GetName() << std::endl;
+
+        if (isTree) {
+            TTree* tree = key->ReadObject<TTree>();
+            TTree*& outputTree = outputTrees[(std::string)outputDir.GetPath() + "/" + key->GetName()];
+            if (outputTree == nullptr) outputTree = outputDir.Get<TTree>(key->GetName());
+            if (outputTree == nullptr) {
+                outputDir.cd();
+                outputTree = tree->CloneTree(-1, "fast");
+            } else {
+                outputTree->CopyEntries(tree, -1, "fast");
+            }
+            delete tree;
+        } else if (isDirectory) {
+            TDirectory* inputSubDir = inputDir.GetDirectory(key->GetName());
+            TDirectory* outputSubDir = outputDir.GetDirectory(key->GetName());
+            if (outputSubDir == nullptr) outputSubDir = outputDir.mkdir(key->GetName(), key->GetTitle());
+            if (inputSubDir == nullptr || outputSubDir == nullptr) {
+                std::cout << "Error: cannot copy directory " << key->GetName() << std::endl;
+                continue;
+            }
+            fastCopyObjects(*inputSubDir, *outputSubDir, outputTrees, checksums, allCycles);
+            continue;
+        } else {
+            // The constructor appends the new key to outputDir
+            TKey* newKey = new TKey(&outputDir, *key, 0);
+            newKey->WriteFile();
+        }
+        if (checksums) deleteOlderCycles(outputDir, key->GetName());
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Rewrites fileName without the free space left by deleted or overwritten
+/// objects. The objects are copied with fastCopyObjects() (without
+/// deserialising them) to a temporary file that replaces fileName. All the
+/// distinct cycles of each object are kept (the identical ones only once),
+/// but only the last cycle of the trees.
+/////////////////////////////////////////////////////////////////////////
+void compactFile(const std::string& fileName) {
+    const std::string tmpFileName = fileName + ".compact";
+    {
+        std::unique_ptr<TFile> input(TFile::Open(fileName.c_str(), "READ"));
+        std::unique_ptr<TFile> output(TFile::Open(tmpFileName.c_str(), "RECREATE"));
+        if (!input || input->IsZombie() || !output || output->IsZombie()) {
+            std::cout << "Error: cannot compact file " << fileName << std::endl;
+            return;
+        }
+        std::cout << "Compacting " << fileName << ":" << std::endl;
+        std::map<std::string, TTree*> outputTrees;
+        std::set<std::string> checksums;
+        fastCopyObjects(*input, *output, outputTrees, &checksums, true);
+        // The registry is not copied by fastCopyObjects
+        std::unique_ptr<TNamed> registry(input->Get<TNamed>(COPY_OBJECTS_REGISTRY));
+        output->cd();
+        if (registry) registry->Write(COPY_OBJECTS_REGISTRY);
+        for (auto& [name, tree] : outputTrees) tree->Write("", TObject::kOverwrite);
+        std::cout << "\t" << input->GetSize() << " bytes -> " << output->GetSize() << " bytes" << std::endl;
+        output->Close();
+    }
+    if (gSystem->Rename(tmpFileName.c_str(), fileName.c_str()) != 0)
+        std::cout << "Error: cannot replace " << fileName << " by its compacted copy " << tmpFileName << std::endl;
+}
 
 /////////////////////////////////////////////////////////////////////////
 /// This macro copies (appends) all the objects from a set of root files 
@@ -8,16 +201,38 @@
 ///                      objects from.
 ///                      See TRestTools::GetFilesMatchingPattern().
 /// * **outputFileName**: name of the file to copy the objects to.
+/// * **fastMerge**: if true, the objects are copied without
+///                  deserialising them and the TTrees with the same name
+///                  are merged into a single one (see fastCopyObjects()).
+/// * **nOpenThreads**: number of input files opened (and their list of
+///                     keys read) at the same time in fastMerge mode (0
+///                     uses all the hardware threads). The copy to the
+///                     output file is always sequential.
+/// * **skipDuplicates**: if true, the objects whose name and content are
+///                       already in the output file (see
+///                       getKnownChecksums()) are not copied again, and only
+///                       the last cycle of every input object is copied.
+///                       Objects with the same name but different content
+///                       are all kept (as cycles of that name).
+/// * **compact**: if true, the output file is rewritten at the end without
+///                dead space (see compactFile()). With an empty
+///                inputFileName only the compaction is done.
 ///
 /// \author: Álvaro Ezquerro aezquerro@unizar.es
 /////////////////////////////////////////////////////////////////////////
 
-void copyObjects(const std::string& inputFileName, const std::string& outputFileName)
+void copyObjects(const std::string& inputFileName, const std::string& outputFileName,
+                 const bool fastMerge = false, const int nOpenThreads = 1,
+                 const bool skipDuplicates = true, const bool compact = false)
 {
+    if (inputFileName.empty()) {
+        if (compact) compactFile(outputFileName);
+        return;
+    }
     
     TFile* outputFile = new TFile(outputFileName.c_str(), "UPDATE");
-    
-    if (outputFile == nullptr) {
+
+    if (outputFile == nullptr || outputFile->IsZombie()) {
         std::cout << "Error: cannot open file " << outputFileName << std::endl;
         return;
     }
@@ -25,11 +240,61 @@ void copyObjects(const std::string& inputFileName, const std::string& outputFile
     std::vector<std::string> inputFileSelection =
             TRestTools::GetFilesMatchingPattern(inputFileName);
 
+    std::set<std::string> checksums;
+    if (skipDuplicates) checksums = getKnownChecksums(*outputFile);
+
+    if (fastMerge) {
+        const unsigned int nWorkers = resolveNumberOfThreads(nOpenThreads);
+        // The next batch is opened in another thread while the current one is copied
+        ROOT::EnableThreadSafety();
+        std::map<std::string, TTree*> outputTrees;
+
+        // The files are opened in batches, to bound the number of open files
+        const size_t batchSize = 4 * nWorkers;
+        auto openBatch = [&](const size_t first) {
+            std::vector<std::unique_ptr<TFile>> files(std::min(batchSize, inputFileSelection.size() - first));
+            parallelFor(files.size(), nWorkers, [&](size_t i, unsigned int) {
+                files[i].reset(TFile::Open(inputFileSelection[first + i].c_str(), "READ"));
+            });
+            return files;
+        };
+        std::vector<std::unique_ptr<TFile>> batch;
+        if (!inputFileSelection.empty()) batch = openBatch(0);
+        for (size_t first = 0; first < inputFileSelection.size(); first += batchSize) {
+            std::future<std::vector<std::unique_ptr<TFile>>> nextBatch;
+            if (first + batchSize < inputFileSelection.size())
+                nextBatch = std::async(std::launch::async, openBatch, first + batchSize);
+
+            for (size_t i = 0; i < batch.size(); i++) {
+                const std::string& file = inputFileSelection[first + i];
+                if (!batch[i] || batch[i]->IsZombie()) {
+                    std::cout << "Error: cannot open file " << file << std::endl;
+                    continue;
+                }
+                std::cout << "From file " << file << std::endl;
+                std::cout << "Copying objects:" << std::endl;
+                fastCopyObjects(*batch[i], *outputFile, outputTrees, skipDuplicates ? &checksums : nullptr);
+                batch[i]->Close();
+            }
+
+            if (nextBatch.valid()) batch = nextBatch.get();
+        }
+
+        for (auto& [name, tree] : outputTrees) {
+            outputFile->cd();
+            tree->Write("", TObject::kOverwrite);
+        }
+        if (skipDuplicates) writeChecksumRegistry(*outputFile, checksums);
+        outputFile->Close();
+        if (compact) compactFile(outputFileName);
+        return;
+    }
+
     for (const auto& file : inputFileSelection) {
        
-        TFile* inputFile = new TFile(inputFileName.c_str(), "READ");
-        if (inputFile == nullptr) {
-            std::cout << "Error: cannot open file " << inputFileName << std::endl;
+        TFile* inputFile = new TFile(file.c_str(), "READ");
+        if (inputFile == nullptr || inputFile->IsZombie()) {
+            std::cout << "Error: cannot open file " << file << std::endl;
             continue;
         }
 
@@ -38,15 +303,26 @@ void copyObjects(const std::string& inputFileName, const std::string& outputFile
         TIter nextkey(inputFile->GetListOfKeys());
         TKey* key;
         while ((key = (TKey*)nextkey())) {
+            if (skipDuplicates) {
+                if (inputFile->GetKey(key->GetName()) != key || (std::string)key->GetName() == COPY_OBJECTS_REGISTRY)
+                    continue;
+                if (!checksums.insert(getKeyChecksum(key)).second) {
+                    std::cout << "\t" << key->GetClassName() << "\t" << key->GetName() << " (already copied, skipped)" << std::endl;
+                    continue;
+                }
+            }
             TObject *obj = key->ReadObj();
             outputFile->cd();
             std::cout << "\t" << key->GetClassName() << "\t" << obj->GetName() << std::endl;
             obj->Write();
             delete obj;
+            if (skipDuplicates) deleteOlderCycles(*outputFile, key->GetName());
         }
 
         inputFile->Close();
     }
 
+    if (skipDuplicates) writeChecksumRegistry(*outputFile, checksums);
     outputFile->Close(); 
+    if (compact) compactFile(outputFileName);
 }
\ No newline at end of file
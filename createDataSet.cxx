@@ -1,14 +1,384 @@
+#include <Compression.h>
+#include <TDataMember.h>
+#include <TKey.h>
+#include <ROOT/RDataFrame.hxx>
+#include <TFile.h>
+#include <TNamed.h>
+#include <TROOT.h>
+#include <TSystem.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <regex>
+#include <sstream>
+
+#include "runCatalog.h"
+#include "stageProfiler.h"
+
+/**
+ * @brief Returns the size and modification time of a file as "size mtime" (empty if it
+ *      cannot be accessed). Used to detect input files that changed.
+ */
+std::string getFileStamp(const std::string& fileName){
+    FileStat_t fileStat;
+    if (gSystem->GetPathInfo(fileName.c_str(), fileStat) != 0)
+        return "";
+    return std::to_string(fileStat.fSize) + " " + std::to_string(fileStat.fMtime);
+}
+
+/**
+ * @brief Returns the canonical absolute path of a file (relative to the working directory,
+ *      without "." or ".." components and with the symbolic links resolved), so the
+ *      same file has the same name whatever pattern selected it.
+ */
+std::string getCanonicalPath(const std::string& fileName){
+    TString path = fileName;
+    if (!gSystem->IsAbsoluteFileName(path))
+        gSystem->PrependPathName(gSystem->WorkingDirectory(), path);
+    char* realPath = realpath(path.Data(), nullptr);
+    if (realPath == nullptr)
+        return path.Data();
+    const std::string canonicalPath = realPath;
+    free(realPath);
+    return canonicalPath;
+}
+
+/**
+ * @brief Returns the number of entries of the AnalysisTree of a data set file (0 if it has none).
+ */
+Long64_t getDataSetEntries(const std::string& dataSetFileName){
+    std::unique_ptr<TFile> f(TFile::Open(dataSetFileName.c_str()));
+    TTree* tree = f ? f->Get<TTree>("AnalysisTree") : nullptr;
+    return tree ? tree->GetEntries() : 0;
+}
+
+/**
+ * @brief Reads the manifest of input files stored in a data set file by createDataSet
+ *      (TNamed "inputFilesManifest", one "fileName<TAB>size mtime" line per file).
+ * 
+ * @return Map from the canonical path of the input file (see getCanonicalPath) to its
+ *      stamp (see getFileStamp). Empty if the file has no manifest.
+ */
+std::map<std::string, std::string> readManifest(const std::string& dataSetFileName){
+    std::map<std::string, std::string> manifest;
+    std::unique_ptr<TFile> f(TFile::Open(dataSetFileName.c_str()));
+    if (!f || f->IsZombie())
+        return manifest;
+    std::unique_ptr<TNamed> named(f->Get<TNamed>("inputFilesManifest"));
+    if (!named)
+        return manifest;
+    std::istringstream lines(named->GetTitle());
+    std::string line;
+    while (std::getline(lines, line)){
+        const auto tab = line.find('\t');
+        if (tab != std::string::npos) // older manifests have the names given by the pattern
+            manifest[getCanonicalPath(line.substr(0, tab))] = line.substr(tab + 1);
+    }
+    return manifest;
+}
+
+/**
+ * @brief Writes (overwriting the previous one) the manifest of input files to a data set file.
+ * 
+ * @return true if the manifest was written.
+ */
+bool writeManifest(const std::string& dataSetFileName, const std::map<std::string, std::string>& manifest){
+    std::string text;
+    for (const auto& [fileName, stamp] : manifest)
+        text += fileName + "\t" + stamp + "\n";
+    std::unique_ptr<TFile> f(TFile::Open(dataSetFileName.c_str(), "UPDATE"));
+    if (!f || f->IsZombie()){
+        std::cout << "ERROR: cannot open " << dataSetFileName << " to write its manifest" << std::endl;
+        return false;
+    }
+    TNamed("inputFilesManifest", text.c_str()).Write("inputFilesManifest", TObject::kOverwrite);
+    f->Close();
+    return true;
+}
+
+/**
+ * @brief Removes the directory dir and the files (or links) in it, if it exists.
+ */
+void removeDirectory(const std::string& dir){
+    void* dirp = gSystem->OpenDirectory(dir.c_str());
+    if (dirp == nullptr)
+        return;
+    while (const char* entry = gSystem->GetDirEntry(dirp)){
+        const std::string name = entry;
+        if (name != "." && name != "..")
+            gSystem->Unlink((dir + "/" + name).c_str());
+    }
+    gSystem->FreeDirectory(dirp);
+    gSystem->Unlink(dir.c_str());
+}
+
+/**
+ * @brief Returns a pointer to the data member name of dataSet (through the dictionary of
+ *      TRestDataSet, as it has no setters for them), or nullptr if it does not exist.
+ */
+template <typename T>
+T* getDataSetMember(TRestDataSet& dataSet, const std::string& name){
+    TDataMember* member = TRestDataSet::Class()->GetDataMember(name.c_str());
+    if (member == nullptr){
+        std::cout << "ERROR: TRestDataSet has no data member " << name << std::endl;
+        return nullptr;
+    }
+    return (T*)((char*)&dataSet + member->GetOffset());
+}
+
+/**
+ * @brief Adds the metadata of added (a data set generated from addedFiles through links)
+ *      to stored: the selected files (with their original names), the start and end
+ *      times and the total duration, so the exposure of the appended data set is right.
+ * 
+ * @return true if all the metadata was updated.
+ */
+bool mergeDataSetMetadata(TRestDataSet& stored, TRestDataSet& added, const std::vector<std::string>& addedFiles){
+    auto fileSelection = getDataSetMember<std::vector<std::string>>(stored, "fFileSelection");
+    auto startTime = getDataSetMember<Double_t>(stored, "fStartTime");
+    auto endTime = getDataSetMember<Double_t>(stored, "fEndTime");
+    auto totalDuration = getDataSetMember<Double_t>(stored, "fTotalDuration");
+    if (!fileSelection || !startTime || !endTime || !totalDuration)
+        return false;
+
+    std::map<std::string, std::string> originalNames;
+    for (const auto& fileName : addedFiles)
+        originalNames[TRestTools::SeparatePathAndName(fileName).second] = fileName;
+    for (const auto& link : added.GetFileSelection())
+        fileSelection->push_back(originalNames[TRestTools::SeparatePathAndName(link).second]);
+    *startTime = std::min(*startTime, added.GetStartTime());
+    *endTime = std::max(*endTime, added.GetEndTime());
+    *totalDuration += added.GetTotalTimeInSeconds();
+    return true;
+}
+
+/**
+ * @brief Appends the data set generated from newFiles to the data set of dataSetFileName.
+ *      The new files are processed by TRestDataSet::GenerateDataSet (through links in a
+ *      temporary directory, so the usual file pattern selection is used) with the
+ *      observables of the existing data set, exported to a temporary file, and its
+ *      entries are copied without decompressing them (TTree::CopyEntries "fast") to
+ *      the existing tree. The TRestDataSet metadata stored in dataSetFileName is updated
+ *      with the new files, time range and duration (see mergeDataSetMetadata).
+ * 
+ * @return true if the entries were appended.
+ */
+bool appendToDataSet(const std::string& dataSetFileName, const std::vector<std::string>& newFiles, const int nThreads){
+    std::vector<std::string> obsList;
+    {
+        std::unique_ptr<TFile> f(TFile::Open(dataSetFileName.c_str()));
+        TTree* dataSetTree = f ? f->Get<TTree>("AnalysisTree") : nullptr;
+        if (dataSetTree==nullptr){
+            std::cout << "ERROR: No AnalysisTree found in data set " << dataSetFileName << std::endl;
+            return false;
+        }
+        for (auto branch : *dataSetTree->GetListOfBranches())
+            obsList.push_back(branch->GetName());
+    }
+
+    // Unique to this process, and emptied first (it could remain from a crashed process with the same pid)
+    const std::string tmpDir = dataSetFileName + ".append." + std::to_string(gSystem->GetPid());
+    const std::string tmpFileName = tmpDir + "/newEntries.root";
+    auto cleanUp = [&](){ removeDirectory(tmpDir); };
+    cleanUp();
+    if (gSystem->mkdir(tmpDir.c_str(), true) != 0){
+        std::cout << "ERROR: cannot create the temporary directory " << tmpDir << std::endl;
+        return false;
+    }
+    for (const auto& fileName : newFiles){
+        auto [path, fName] = TRestTools::SeparatePathAndName(fileName);
+        TString target = fileName;
+        if (!gSystem->IsAbsoluteFileName(target))
+            gSystem->PrependPathName(gSystem->WorkingDirectory(), target);
+        const std::string link = tmpDir + "/" + fName;
+        if (gSystem->Symlink(target, link.c_str()) != 0){
+            std::cout << "ERROR: cannot link " << fileName << " to " << link << std::endl;
+            cleanUp();
+            return false;
+        }
+    }
+
+    TRestDataSet ds;
+    ds.SetName("ds");
+    ds.SetFilePattern(tmpDir + "/*.root");
+    ds.SetObservablesList(obsList);
+    if (nThreads != 1){
+        ROOT::EnableImplicitMT(std::max(0, nThreads));
+        ds.EnableMultiThreading(true);
+    }
+    ds.GenerateDataSet();
+    ds.Export(tmpFileName);
+
+    bool appended = false;
+    {
+        std::unique_ptr<TFile> in(TFile::Open(tmpFileName.c_str()));
+        std::unique_ptr<TFile> out(TFile::Open(dataSetFileName.c_str(), "UPDATE"));
+        TTree* newTree = in ? in->Get<TTree>("AnalysisTree") : nullptr;
+        TTree* dataSetTree = out ? out->Get<TTree>("AnalysisTree") : nullptr;
+        TKey* dataSetKey = nullptr;
+        if (out)
+            for (auto key : *out->GetListOfKeys()){
+                TClass* cl = TClass::GetClass(((TKey*)key)->GetClassName());
+                if (cl && cl->InheritsFrom(TRestDataSet::Class()))
+                    dataSetKey = (TKey*)key;
+            }
+        std::unique_ptr<TRestDataSet> storedDataSet(dataSetKey ? dataSetKey->ReadObject<TRestDataSet>() : nullptr);
+        if (newTree && dataSetTree && storedDataSet){
+            std::cout << "Appending " << newTree->GetEntries() << " entries to the " << dataSetTree->GetEntries()
+                      << " of " << dataSetFileName << std::endl;
+            dataSetTree->CopyEntries(newTree, -1, "fast");
+            dataSetTree->Write("", TObject::kOverwrite);
+            out->cd();
+            if (mergeDataSetMetadata(*storedDataSet, ds, newFiles))
+                storedDataSet->Write(dataSetKey->GetName(), TObject::kOverwrite);
+            else
+                std::cout << "ERROR: the metadata of " << dataSetFileName << " was not updated" << std::endl;
+            appended = true;
+        } else {
+            std::cout << "ERROR: could not append " << tmpFileName << " to " << dataSetFileName << std::endl;
+        }
+    }
+    cleanUp();
+    return appended;
+}
+
+/**
+ * @brief Exports the data set of ds to outputFileName writing the tree with a
+ *      RDataFrame snapshot, with the given compression, clusters and baskets, instead of
+ *      TRestDataSet::Export. The TRestDataSet metadata (needed to import it) is written
+ *      to the file too. The compressed and uncompressed sizes and the write speed are
+ *      printed at the end.
+ * 
+ * @param compression Algorithm and level as "ALGORITHM:level", with ALGORITHM one of
+ *      ZSTD, LZ4, ZLIB or LZMA, e.g. "ZSTD:5" or "LZ4:4". If the level is omitted
+ *      the RSnapshotOptions default (1) is used. The level must be a single digit (0-9).
+ *      Empty keeps the RSnapshotOptions default compression.
+ * @param memoryBudgetMB Approximate memory (MB) used to buffer baskets before they are
+ *      written: the tree is flushed (a cluster is closed) every memoryBudgetMB,
+ *      shared among the implicit MT slots. 0 keeps the ROOT default (30 MB per tree).
+ *      Not used if clusterSize is given.
+ * @param clusterSize Number of entries of each cluster (the tree is flushed every
+ *      clusterSize entries). 0 uses memoryBudgetMB.
+ * @param basketSize Size (bytes) of the buffer of each branch. 0 keeps the ROOT default.
+ * 
+ * @return true if the data set was exported.
+ */
+bool streamingExport(TRestDataSet& ds, const std::string& outputFileName, const std::string& compression,
+                     const double memoryBudgetMB = 0, const int clusterSize = 0, const int basketSize = 0){
+    ROOT::RDF::RSnapshotOptions options;
+    std::string algorithm = compression.substr(0, compression.find(':'));
+    std::transform(algorithm.begin(), algorithm.end(), algorithm.begin(), ::toupper);
+    const std::map<std::string, ROOT::RCompressionSetting::EAlgorithm::EValues> algorithms = {
+        {"ZSTD", ROOT::RCompressionSetting::EAlgorithm::kZSTD},
+        {"LZ4", ROOT::RCompressionSetting::EAlgorithm::kLZ4},
+        {"ZLIB", ROOT::RCompressionSetting::EAlgorithm::kZLIB},
+        {"LZMA", ROOT::RCompressionSetting::EAlgorithm::kLZMA}};
+    if (!compression.empty() && algorithms.count(algorithm) == 0){
+        std::cout << "ERROR: unknown compression algorithm " << algorithm << " (use ZSTD, LZ4, ZLIB or LZMA)" << std::endl;
+        return false;
+    }
+    if (!compression.empty())
+        options.fCompressionAlgorithm = algorithms.at(algorithm);
+    if (compression.find(':') != std::string::npos){
+        const std::string level = compression.substr(compression.find(':') + 1);
+        if (level.size() != 1 || !std::isdigit((unsigned char)level[0])){
+            std::cout << "ERROR: invalid compression level " << level << " (use a level from 0 to 9)" << std::endl;
+            return false;
+        }
+        options.fCompressionLevel = level[0] - '0';
+    }
+    if (clusterSize > 0){
+        options.fAutoFlush = clusterSize;
+    } else if (memoryBudgetMB > 0){
+        const unsigned int nSlots = std::max(1u, ROOT::GetThreadPoolSize());
+        options.fAutoFlush = -(Long64_t)(memoryBudgetMB * 1024 * 1024 / nSlots);
+    }
+    if (basketSize > 0)
+        options.fBasketSize = basketSize;
+
+    auto begin = std::chrono::steady_clock::now();
+    ds.GetDataFrame().Snapshot("AnalysisTree", outputFileName, ds.GetDataFrame().GetColumnNames(), options);
+    auto end = std::chrono::steady_clock::now();
+
+    std::unique_ptr<TFile> f(TFile::Open(outputFileName.c_str(), "UPDATE"));
+    TTree* tree = f ? f->Get<TTree>("AnalysisTree") : nullptr;
+    if (tree == nullptr){
+        std::cout << "ERROR: could not write the data set to " << outputFileName << std::endl;
+        return false;
+    }
+    ds.Write();
+    const double seconds = std::chrono::duration<double>(end - begin).count();
+    const double totBytes = tree->GetTotBytes(), zipBytes = tree->GetZipBytes();
+    std::cout << "Exported " << tree->GetEntries() << " entries to " << outputFileName << " ("
+              << (compression.empty() ? std::string("default compression") : algorithm + ":" + std::to_string(options.fCompressionLevel))
+              << ", " << tree->GetAutoFlush() << " entries per cluster)" << std::endl;
+    std::cout << "\tUncompressed " << totBytes / 1e6 << " MB, compressed " << zipBytes / 1e6 << " MB (ratio "
+              << (zipBytes > 0 ? totBytes / zipBytes : 0) << ")" << std::endl;
+    std::cout << "\tWritten in " << seconds << " s: " << totBytes / 1e6 / seconds << " MB/s uncompressed, "
+              << zipBytes / 1e6 / seconds << " MB/s compressed" << std::endl;
+    f->Close();
+    return true;
+}
 
 /**
  * @brief Creates a data set from a file pattern and saves it to an output file.
  *      The data set is created with all the observables from the TRestAnalysisTree
  *      of the first file matching the pattern.
  * 
+ *      Only the observables matching includeRegex and not matching excludeRegex are
+ *      kept, so only those branches are read from the input files.
+ * 
  * @param filePattern The pattern of the input files to be used to create the data set.
  * @param outputFileName The name of the output file where the data set will be saved.
+ * @param includeRegex Regular expression (ECMAScript, matching the whole name) of the
+ *      observables to keep, e.g. "rawAna_.*|hitsAna_.*". Empty keeps all of them.
+ * @param excludeRegex Regular expression of the observables to drop (applied after
+ *      includeRegex), e.g. ".*_Sigma.*". Empty drops none.
+ * @param nThreads Number of threads used to read the input files (0 uses all the
+ *      hardware threads). With 1 the TRestDataSet default is kept.
+ * @param append If true and outputFileName exists, only the input files not listed in
+ *      its manifest (written by every call of this macro) are processed, and their
+ *      entries are appended to it (see appendToDataSet). The observables of the existing
+ *      data set are used. If an input file already listed changed (size or modification
+ *      time), the whole data set is generated again.
+ * @param useCatalog If true, the observables of the first input file and whether the
+ *      input files have an AnalysisTree are taken from the run catalog of their directory
+ *      (see runCatalog.h), written there as RUN_CATALOG_FILE_NAME, instead of opening the
+ *      first file. It only saves that open on later calls: GenerateDataSet still opens
+ *      every input file.
+ * @param compression If not empty, the data set is exported by streamingExport with
+ *      this compression ("ZSTD:5", "LZ4:4", "ZLIB:1"...) instead of TRestDataSet::Export.
+ * @param memoryBudgetMB Memory for the baskets of the streaming export (see
+ *      streamingExport).
+ * @param clusterSize Entries per cluster of the streaming export (0 derives it from
+ *      memoryBudgetMB, see streamingExport).
+ * @param basketSize Basket size (bytes) of the streaming export (0 keeps the ROOT default).
+ *      If any of compression, memoryBudgetMB, clusterSize or basketSize is given, the data
+ *      set is exported by streamingExport.
+ * @param profileOutput If not empty, the wall and CPU time, peak memory, bytes read and
+ *      written and entries of every stage (run catalog, GenerateDataSet, Export or the
+ *      append) are appended to this file (see stageProfiler.h): a TTree if it is a .root
+ *      file, JSON lines otherwise. The events are read when the data set is exported.
  */
-void createDataSet(std::string filePattern = "./data/R01850_*_Hits_Calibration_109Cd_Both_cronTREX_V2.3.13.root", std::string outputFileName = ""){
+void createDataSet(std::string filePattern = "./data/R01850_*_Hits_Calibration_109Cd_Both_cronTREX_V2.3.13.root", std::string outputFileName = "",
+                   const std::string& includeRegex = "", const std::string& excludeRegex = "", const int nThreads = 1,
+                   const bool append = false, const bool useCatalog = false,
+                   const std::string& compression = "", const double memoryBudgetMB = 0,
+                   const std::string& profileOutput = "", const int clusterSize = 0, const int basketSize = 0){
     
+    std::unique_ptr<StageProfiler> profiler(profileOutput.empty() ? nullptr : new StageProfiler("createDataSet"));
+    auto writeProfile = [&](){
+        if (!profiler)
+            return;
+        profiler->Print();
+        profiler->Write(profileOutput);
+    };
+
     TRestDataSet ds;
     ds.SetName("ds"); //si no tiene nombre (el TObject), luego no se puede leer del archivo .root
     std::vector<std::string> fileSelection = TRestTools::GetFilesMatchingPattern(filePattern);
@@ -18,23 +388,6 @@ void createDataSet(std::string filePattern = "./data/R01850_*_Hits_Calibration_1
     }
     ds.SetFilePattern(filePattern);
 
-    //Get the list of all observables from first file
-    TFile f(fileSelection.at(0).c_str());
-    TRestAnalysisTree *tree = (TRestAnalysisTree*) f.Get<TRestAnalysisTree>("AnalysisTree");
-    if (tree==nullptr){
-        std::cout << "ERROR: No AnalysisTree with name \"AnalysisTree\" found in file " << fileSelection.at(0) << std::endl;
-        return;
-    }
-    std::vector<std::string> obsList = tree->GetObservableNames();
-    if (obsList.empty()){
-        std::cout << "ERROR: no observables found in AnalysisTree at file " << fileSelection.at(0) << std::endl;
-        return;
-    }
-    ds.SetObservablesList(obsList);
-
-    //Generate data set
-    ds.GenerateDataSet();
-
     //Autoset outputFileName (based on typical R{runNumber}_{subrunNumber}_{tags}.root format) to D{runNumber}_{tags}.root
     if (outputFileName.empty()){
         auto [path, fName] = TRestTools::SeparatePathAndName(fileSelection.at(0));
@@ -45,6 +398,124 @@ void createDataSet(std::string filePattern = "./data/R01850_*_Hits_Calibration_1
         outputFileName = path + fName;
         std::cout << "Warning: no outputFileName defined. Autosetting to " << outputFileName << std::endl;
     }
-    ds.Export(outputFileName);
+
+    std::map<std::string, std::string> manifest;
+    for (const auto& fileName : fileSelection)
+        manifest[getCanonicalPath(fileName)] = getFileStamp(fileName);
+
+    //Append mode: process only the input files not in the data set yet
+    if (append && TRestTools::fileExists(outputFileName)){
+        const auto previousManifest = readManifest(outputFileName);
+        std::vector<std::string> newFiles;
+        bool changed = previousManifest.empty();
+        for (const auto& [fileName, stamp] : manifest){
+            auto it = previousManifest.find(fileName);
+            if (it == previousManifest.end())
+                newFiles.push_back(fileName);
+            else if (it->second != stamp)
+                changed = true;
+        }
+        if (changed){
+            std::cout << "Warning: " << outputFileName << " has no manifest or some of its input files changed. Generating the whole data set" << std::endl;
+        } else if (newFiles.empty()){
+            std::cout << outputFileName << " is up to date" << std::endl;
+            return;
+        } else {
+            std::cout << "Appending " << newFiles.size() << " new files to " << outputFileName << std::endl;
+            // The entries are counted outside of the stage, so their reading is not measured
+            const Long64_t previousEntries = profiler ? getDataSetEntries(outputFileName) : 0;
+            bool appended = false;
+            {
+                StageProfiler::Scope stage(profiler.get(), "appendToDataSet", outputFileName);
+                appended = appendToDataSet(outputFileName, newFiles, nThreads);
+            }
+            if (profiler)
+                profiler->SetEntries(getDataSetEntries(outputFileName) - previousEntries);
+            if (appended){
+                for (const auto& [fileName, stamp] : previousManifest)
+                    manifest[fileName] = stamp;
+                writeManifest(outputFileName, manifest);
+            }
+            writeProfile();
+            return;
+        }
+    }
+
+    //Get the list of all observables from first file (from the run catalog if useCatalog)
+    std::vector<std::string> obsList;
+    if (useCatalog){
+        std::map<std::string, RunCatalogEntry> catalog;
+        {
+            StageProfiler::Scope stage(profiler.get(), "getRunCatalog", filePattern);
+            catalog = getRunCatalog(fileSelection);
+        }
+        for (const auto& fileName : fileSelection)
+            if (!catalog.at(fileName).fHasAnalysisTree)
+                std::cout << "Warning: No AnalysisTree found in file " << fileName << std::endl;
+        const auto& first = catalog.at(fileSelection.at(0));
+        if (!first.fHasAnalysisTree){
+            std::cout << "ERROR: No AnalysisTree with name \"AnalysisTree\" found in file " << fileSelection.at(0) << std::endl;
+            return;
+        }
+        obsList = first.fObservables;
+    } else {
+        TFile f(fileSelection.at(0).c_str());
+        TRestAnalysisTree *tree = (TRestAnalysisTree*) f.Get<TRestAnalysisTree>("AnalysisTree");
+        if (tree==nullptr){
+            std::cout << "ERROR: No AnalysisTree with name \"AnalysisTree\" found in file " << fileSelection.at(0) << std::endl;
+            return;
+        }
+        obsList = tree->GetObservableNames();
+    }
+    if (obsList.empty()){
+        std::cout << "ERROR: no observables found in AnalysisTree at file " << fileSelection.at(0) << std::endl;
+        return;
+    }
+
+    //Keep only the selected observables
+    std::regex include, exclude;
+    try {
+        include = std::regex(includeRegex.empty() ? ".*" : includeRegex);
+        exclude = std::regex(excludeRegex);
+    } catch (const std::regex_error& e) {
+        std::cout << "ERROR: invalid observable regex: " << e.what() << std::endl;
+        return;
+    }
+    std::vector<std::string> selectedObsList;
+    for (const auto& obs : obsList) {
+        if (!std::regex_match(obs, include)) continue;
+        if (!excludeRegex.empty() && std::regex_match(obs, exclude)) continue;
+        selectedObsList.push_back(obs);
+    }
+    if (selectedObsList.empty()){
+        std::cout << "ERROR: no observables selected (include \"" << includeRegex << "\", exclude \"" << excludeRegex << "\")" << std::endl;
+        return;
+    }
+    std::cout << "Selected " << selectedObsList.size() << " of " << obsList.size() << " observables" << std::endl;
+    ds.SetObservablesList(selectedObsList);
+
+    //Read the input files in parallel (GenerateDataSet does not enable it again if it is already enabled)
+    if (nThreads != 1){
+        ROOT::EnableImplicitMT(std::max(0, nThreads));
+        ds.EnableMultiThreading(true);
+    }
+
+    //Generate data set
+    {
+        StageProfiler::Scope stage(profiler.get(), "GenerateDataSet", filePattern);
+        ds.GenerateDataSet();
+    }
+    {
+        const bool streaming = !compression.empty() || memoryBudgetMB > 0 || clusterSize > 0 || basketSize > 0;
+        StageProfiler::Scope stage(profiler.get(), streaming ? "streamingExport" : "Export", outputFileName);
+        if (!streaming)
+            ds.Export(outputFileName);
+        else if (!streamingExport(ds, outputFileName, compression, memoryBudgetMB, clusterSize, basketSize))
+            return;
+    }
+    if (profiler)
+        profiler->SetEntries(getDataSetEntries(outputFileName));
+    writeManifest(outputFileName, manifest);
+    writeProfile();
 
 }
\ No newline at end of file
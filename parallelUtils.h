@@ -0,0 +1,192 @@
+/////////////////////////////////////////////////////////////////////////
+/// Small threading helpers shared by the macros.
+///
+/// They only rely on the standard library (and ThreadSafeMinimizer on
+/// ROOT's MinimizerOptions), so they can be included from any macro
+/// (interpreted or compiled with ACLiC). Remember to call
+/// ROOT::EnableThreadSafety() before running ROOT code inside the tasks.
+///
+/// \author: Álvaro Ezquerro aezquerro@unizar.es
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef REST_MACROS_PARALLEL_UTILS_H
+#define REST_MACROS_PARALLEL_UTILS_H
+
+#include <Math/MinimizerOptions.h>
+#include <TROOT.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Number of workers to use for a given request: nThreads if it is
+/// positive, the number of hardware threads otherwise. Never less than 1.
+inline unsigned int resolveNumberOfThreads(const int nThreads) {
+    if (nThreads > 0) return nThreads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/// Runs task(index, workerId) for every index in [0, nTasks) using nWorkers
+/// threads. Each worker takes the next pending index as soon as it is free,
+/// so tasks with very different costs are still balanced. Worker 0 runs on
+/// the calling thread. Returns the time (ms) each worker spent inside task.
+inline std::vector<double> parallelFor(const size_t nTasks, unsigned int nWorkers,
+                                       const std::function<void(size_t, unsigned int)>& task) {
+    nWorkers = std::max(1u, nWorkers);
+    std::vector<double> busyTime(nWorkers, 0);
+    std::atomic<size_t> next(0);
+
+    auto work = [&](const unsigned int workerId) {
+        for (size_t i = next++; i < nTasks; i = next++) {
+            auto begin = std::chrono::steady_clock::now();
+            task(i, workerId);
+            auto end = std::chrono::steady_clock::now();
+            busyTime[workerId] += std::chrono::duration<double, std::milli>(end - begin).count();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < nWorkers; t++) threads.emplace_back(work, t);
+    work(0);
+    for (auto& th : threads) th.join();
+
+    return busyTime;
+}
+
+/// Mutex to serialise the construction of REST metadata objects from rml
+/// files (the rml parsing is not thread safe).
+inline std::mutex& restConfigMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// While it exists, the default minimizer is a thread safe one: if it is
+/// TMinuit ("Minuit" or "TMinuit"), Minuit2 (with the same algorithm) is
+/// used instead. The previous default is restored at destruction, so the
+/// fits done afterwards are not affected. It must be created before
+/// starting the threads that fit and destroyed after joining them, as the
+/// default minimizer is shared by the whole process.
+/////////////////////////////////////////////////////////////////////////
+class ThreadSafeMinimizer {
+   public:
+    ThreadSafeMinimizer()
+        : fType(ROOT::Math::MinimizerOptions::DefaultMinimizerType()),
+          fAlgo(ROOT::Math::MinimizerOptions::DefaultMinimizerAlgo()) {
+        fChanged = fType == "Minuit" || fType == "TMinuit";
+        if (fChanged) ROOT::Math::MinimizerOptions::SetDefaultMinimizer("Minuit2", fAlgo.c_str());
+    }
+
+    ~ThreadSafeMinimizer() {
+        if (fChanged) ROOT::Math::MinimizerOptions::SetDefaultMinimizer(fType.c_str(), fAlgo.c_str());
+    }
+
+    /// True if the default minimizer was replaced.
+    bool Changed() const { return fChanged; }
+
+   private:
+    std::string fType;
+    std::string fAlgo;
+    bool fChanged = false;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// While it exists, ROOT implicit multithreading is disabled (e.g. so a
+/// RDataFrame keeps the order of the entries). If it was enabled, it is
+/// enabled again at destruction with the same number of threads.
+/////////////////////////////////////////////////////////////////////////
+class ImplicitMTDisabled {
+   public:
+    ImplicitMTDisabled() : fEnabled(ROOT::IsImplicitMTEnabled()), fPoolSize(ROOT::GetThreadPoolSize()) {
+        if (fEnabled) ROOT::DisableImplicitMT();
+    }
+
+    ~ImplicitMTDisabled() {
+        if (fEnabled) ROOT::EnableImplicitMT(fPoolSize);
+    }
+
+   private:
+    bool fEnabled = false;
+    unsigned int fPoolSize = 0;
+};
+
+/// Thread whose BufferedCout buffer the calling thread writes to (itself
+/// unless an OutputOwnerScope says otherwise).
+inline std::thread::id& outputOwnerThread() {
+    thread_local std::thread::id owner = std::this_thread::get_id();
+    return owner;
+}
+
+/// While it exists, the output of the calling thread goes to the
+/// BufferedCout buffer of owner. Used in the tasks of a nested parallelFor,
+/// with owner the outputOwnerThread() of the thread that started it, so
+/// their output is flushed with the rest of the output of that thread.
+class OutputOwnerScope {
+   public:
+    explicit OutputOwnerScope(const std::thread::id owner) : fPrevious(outputOwnerThread()) {
+        outputOwnerThread() = owner;
+    }
+    ~OutputOwnerScope() { outputOwnerThread() = fPrevious; }
+
+   private:
+    std::thread::id fPrevious;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// While it exists, what any thread writes to std::cout is kept in a
+/// buffer of that thread (or of its outputOwnerThread()) instead of being
+/// printed. Flush() prints (at once) and clears the buffer of the calling
+/// thread, so the output of tasks running in parallel does not interleave.
+/// The remaining buffers are flushed, and std::cout restored, at
+/// destruction. Only std::cout is captured (not printf nor std::cerr).
+/////////////////////////////////////////////////////////////////////////
+class BufferedCout : public std::streambuf {
+   public:
+    BufferedCout() : fOriginal(std::cout.rdbuf(this)) {}
+
+    ~BufferedCout() {
+        std::cout.rdbuf(fOriginal);
+        for (auto& [id, buffer] : fBuffers) fOriginal->sputn(buffer.data(), buffer.size());
+        fOriginal->pubsync();
+    }
+
+    void Flush() {
+        std::lock_guard<std::mutex> lock(fMutex);
+        std::string& buffer = GetBuffer();
+        fOriginal->sputn(buffer.data(), buffer.size());
+        fOriginal->pubsync();
+        buffer.clear();
+    }
+
+   protected:
+    // A buffer may be shared by several threads (see OutputOwnerScope), so the writes are locked too
+    int overflow(int c) override {
+        std::lock_guard<std::mutex> lock(fMutex);
+        if (c != traits_type::eof()) GetBuffer().push_back(traits_type::to_char_type(c));
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        std::lock_guard<std::mutex> lock(fMutex);
+        GetBuffer().append(s, n);
+        return n;
+    }
+
+   private:
+    // fMutex must be locked
+    std::string& GetBuffer() { return fBuffers[outputOwnerThread()]; }
+
+    std::streambuf* fOriginal;
+    std::mutex fMutex;
+    std::map<std::thread::id, std::string> fBuffers;
+};
+
+#endif
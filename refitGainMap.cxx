@@ -24,6 +24,15 @@
 /// dialog canvas. The user can also export the gain map to a
 /// root file with the command 'gm.Export();' in the terminal.
 ///
+/// Only the segments that may have been modified (drawn alone, or with
+/// peaks added or deleted) are refitted when changing the module, and
+/// only the pads that changed are redrawn: adding or deleting a peak and
+/// updating the fits redraw the pad of the segment at cAll and cAlone,
+/// without selecting the segment again.
+///
+/// If a report of autoRefitGainMap.cxx is given, only the modules and
+/// segments whose fits are still failing are offered for review.
+///
 /// \author: Álvaro Ezquerro aezquerro@unizar.es
 ///
 /// Possible improvements:
@@ -34,6 +43,10 @@
 TRestDataSetGainMap gm;
 TRestDataSetGainMap::Module *m = nullptr;
 std::map<std::string,double> meansAux={};//to store the previous fit means (for add peak functionality)
+std::set<std::pair<int,int>> dirtySegments={};//segments of the current module whose calibration fits may be outdated
+size_t highlightedPad = 0;//pad of cAll currently highlighted (0 if none)
+const uint highlightColor = 38; // set color here (38 es azul apagado)
+std::set<std::tuple<int,int,int,int>> failingSegments={};//(plane, module, x, y) to review, from the autoRefitGainMap report (all if empty)
 
 const int screenWidth = gClient->GetDisplayWidth();
 const int screenHeight = gClient->GetDisplayHeight();
@@ -49,6 +62,7 @@ TCanvas *cAlone = new TCanvas("cAlone","cAlone", cAloneWidth, cAloneHeight);
 // Functions declarations
 void drawAll();
 void drawAlone(const int x, const int y);
+void redrawAlone(const int x, const int y);
 void drawWithinAll(int x, int y);
 void clearCanvas(TCanvas *c, size_t n_subPad);
 void highlightDrawnAlonePad(const int x, const int y);
@@ -56,6 +70,9 @@ void DeletePeak(const int x, const int y, const int peakNumber);
 void AddPeak(const int x, const int y, const int peakNumber);
 void UpdateFits(const int x, const int y);
 void changeModule(int plane, int module);
+void exportGainMap();
+bool isToReview(int plane, int module, int x = -1, int y = -1);
+void readReport(const std::string& reportFile);
 TDialogCanvas* createDialog();
 
 // Functions definitions
@@ -83,8 +100,10 @@ void drawWithinAll(int x, int y) {
     } else {// if it has been closed
         cAll = new TCanvas("cAll","cAll", cAllWidth, cAllHeight);
         cAll->Divide(m->GetNumberOfSegmentsX(), m->GetNumberOfSegmentsY());
+        highlightedPad = 0;
     }
     cAll->cd(nSubPad);
+    if (nSubPad == highlightedPad) cAll->GetPad(nSubPad)->SetFillColor(highlightColor); // cleared by clearCanvas
     m->DrawSpectrum((size_t)x, (size_t) y, true, -1, cAll);
 
     std::string action = (string)"drawAlone(" + std::to_string(x) + (string)"," 
@@ -95,6 +114,8 @@ void drawWithinAll(int x, int y) {
 }
 
 void drawAlone(const int x, const int y) {
+    // Its fits may be modified with the FIT PANEL
+    dirtySegments.insert({x, y});
 
     for (TObject *obj : *m->fSegSpectra.at(x).at(y)->GetListOfFunctions()) {
         if (obj && obj->InheritsFrom(TF1::Class())) {
@@ -103,6 +124,13 @@ void drawAlone(const int x, const int y) {
         }
     }
 
+    redrawAlone(x, y);
+
+    // Highlight the segment in the cAll canvas
+    highlightDrawnAlonePad(x, y);
+}
+
+void redrawAlone(const int x, const int y) {
     // Reset the canvas
     if (cAlone->GetCanvasImp()){
         clearCanvas(cAlone);
@@ -146,48 +174,33 @@ void drawAlone(const int x, const int y) {
         }
     }
     cAlone->Update();
-
-    // Highlight the segment in the cAll canvas
-    highlightDrawnAlonePad(x, y);
 }
 
 void highlightDrawnAlonePad(const int x, const int y){
-    uint COLOR = 38; // set color here (38 es azul apagado)
-
-    // Get the number of pads inside the canvas
-    size_t nPads = 0;
-    for (const auto& object : *cAll->GetListOfPrimitives())
-        if (object->InheritsFrom(TVirtualPad::Class())) ++nPads;
-
     size_t n_subPad = x+1 + m->GetNumberOfSegmentsX()*(m->GetNumberOfSegmentsY()-y-1);
+    size_t nPads = m->GetNumberOfSegmentsX()*m->GetNumberOfSegmentsY();
+    if (n_subPad > nPads) {
+        std::cout << "Error: the number of pads is " << nPads << " and the selected pad is " << n_subPad << std::endl;
+        return;
+    }
 
-    // Reset previous highlights
-    for (size_t i = 0; i < nPads; i++) {
-        if (i == n_subPad) continue; // skip the selected pad
-        TVirtualPad *pad = (TVirtualPad*) cAll->cd(i+1);
-        if (pad->GetFillColor() != 0) { // 0 is white
+    // Reset the previous highlight (only that pad can be highlighted)
+    if (highlightedPad != 0 && highlightedPad != n_subPad) {
+        TVirtualPad *pad = cAll->GetPad(highlightedPad);
+        if (pad && pad->GetFillColor() != 0) { // 0 is white
             pad->SetFillColor(0);
             pad->Modified();
-            pad->Update();
         }
     }
 
     // Highlight the selected pad
-    if (n_subPad > nPads) {
-        std::cout << "Error: the number of pads is " << nPads << " and the selected pad is " << n_subPad << std::endl;
-        return;
+    highlightedPad = n_subPad;
+    TVirtualPad *pad = cAll->GetPad(n_subPad);
+    if (pad->GetFillColor() != highlightColor) { // no need to modify it to same color
+        pad->SetFillColor(highlightColor);
+        pad->Modified();
     }
-    TVirtualPad *pad = (TVirtualPad*) cAll->cd(n_subPad);
-    if (pad->GetFillColor() == COLOR) return; // no need to modify it to same color
-    pad->SetFillColor(COLOR);
-    pad->Modified();
-    pad->Update();
-    /*
-    cAll->cd(n_subPad);
-    gPad->SetFillColor(kYellow);
-    gPad->Modified();
-    gPad->Update();
-    */
+    cAll->Update(); // only the modified pads are repainted
 }
 
 void DeletePeak(const int x, const int y, const int peakNumber){
@@ -199,10 +212,12 @@ void DeletePeak(const int x, const int y, const int peakNumber){
         //std::cout << "Deleting peak " << peakNumber << " in segment " << x << "," << y << std::endl;
         h->GetListOfFunctions()->Remove(f);
         gr->RemovePoint(peakNumber); // unnecessary as UpdateCalibrationFits will remove it
+        dirtySegments.insert({x, y});
     }
     
-    drawWithinAll(x,y); // Update the canvas with all the segments
-    drawAlone(x,y); // Update the canvas alone
+    // Only the spectrum of this segment changed: its pad at cAll and cAlone (already selected and highlighted)
+    drawWithinAll(x,y);
+    redrawAlone(x,y);
 }
 
 void AddPeak(const int x, const int y, const int peakNumber){
@@ -210,18 +225,21 @@ void AddPeak(const int x, const int y, const int peakNumber){
     std::string objName = "g" + std::to_string(peakNumber);
     TF1* g = new TF1(objName.c_str(), "gaus", meansAux[objName]*0.8, meansAux[objName]*1.2);
     h->Fit(g, "R+Q0");
+    dirtySegments.insert({x, y});
     //segSpectraCopy.at(peakNumber).Copy(*g);
     //h->GetListOfFunctions()->Add(g); //already added by fitting with options '+'
     //UpdateCalibrationFit(x, y, peakNumber, g->GetParameter(1));
     
-    drawWithinAll(x,y); // Update the canvas with all the segments
-    drawAlone(x,y); // Update the canvas alone
+    // Only the spectrum of this segment changed: its pad at cAll and cAlone (already selected and highlighted)
+    drawWithinAll(x,y);
+    redrawAlone(x,y);
 }
 
 void UpdateFits(const int x, const int y){
     TH1F* h = m->fSegSpectra.at(x).at(y);
 
     TList* list = h->GetListOfFunctions();
+    bool hasFits = false;
     for (size_t n = 0; n<m->fEnergyPeaks.size() ; n++){
         // find the last TF1 named gn because FitPanel with "AddToList" option
         // will add another fit with the same name at last position
@@ -245,11 +263,17 @@ void UpdateFits(const int x, const int y){
 
         if (h->GetFunction(objName.c_str()))
             //m->UpdateCalibrationFit(x, y, n, h->GetFunction(objName.c_str())->GetParameter(1)); //this function is not in the framework repository
-            m->UpdateCalibrationFits(x, y);
+            hasFits = true;
+    }
+    // It uses all the peak fits of the segment, so once is enough
+    if (hasFits) {
+        m->UpdateCalibrationFits(x, y);
+        dirtySegments.erase({x, y});
     }
     //cAlone->Modified();
-    drawWithinAll(x,y); // Update the canvas with all the segments
-    drawAlone(x,y); // Update the canvas alone. Done after drawWithinAll to highlight the pad at cAll
+    // Only the spectrum of this segment changed: its pad at cAll and cAlone (already selected and highlighted)
+    drawWithinAll(x,y);
+    redrawAlone(x,y);
     
     // --- PRINT INFO ---
     std::cout << std::endl;
@@ -294,12 +318,14 @@ void drawAll() {
         cAll = new TCanvas("cAll","cAll",900,700);
 
     m->DrawSpectrum(true,-1, cAll);
+    highlightedPad = 0;
     // Add all the 'draw alone' buttons
     for (size_t i = 0; i <m->fSegSpectra.size(); i++) {
         for (size_t j = 0; j <m->fSegSpectra[i].size(); j++) {
             cAll->cd(i + 1 +m->fSegSpectra[i].size() * j);
             /*std::string action = (string)"m->DrawSpectrum((size_t)" + std::to_string(i) + (string)",(size_t)" + std::to_string(m->fSegSpectra[i].size() - 1 - j)
              + (string)", true, -1, cAlone);";//*/
+            if (!isToReview(m->GetPlaneId(), m->GetModuleId(), i, m->fSegSpectra[i].size() - 1 - j)) continue;
             std::string action = (string)"drawAlone(" + std::to_string(i) + (string)"," + std::to_string(m->fSegSpectra[i].size() - 1 - j) + (string)");";
             TButton *but = new TButton("Draw alone", action.c_str(), .5,.8,.8,.88);
             but->Draw();
@@ -309,13 +335,16 @@ void drawAll() {
 }
 
 void changeModule(int plane, int module){
-    // Updating the fits of all segments of the previous module
+    auto newModule = gm.GetModule(plane,module);
+    if (newModule && newModule == m && cAll->GetCanvasImp()) return; // already drawn
+
+    // Updating the fits of the segments of the previous module that may have changed
     if (m) {
-        for (size_t i = 0; i <m->fSegSpectra.size(); i++) 
-            for (size_t j = 0; j <m->fSegSpectra[i].size(); j++) 
-                m->UpdateCalibrationFits(i, j);
+        for (const auto& [i, j] : dirtySegments)
+            m->UpdateCalibrationFits(i, j);
     }
-    m = gm.GetModule(plane,module);
+    dirtySegments.clear();
+    m = newModule;
     if(!m) return;
 
     // Reset the canvas cAlone
@@ -330,6 +359,42 @@ void changeModule(int plane, int module){
     cAll->Update();
 }
 
+void exportGainMap(){
+    // Updating the fits of the segments of the current module that may have changed
+    if (m) {
+        for (const auto& [i, j] : dirtySegments)
+            m->UpdateCalibrationFits(i, j);
+    }
+    dirtySegments.clear();
+    gm.Export();
+}
+
+bool isToReview(int plane, int module, int x, int y){
+    if (failingSegments.empty()) return true;
+    for (const auto& [p, mm, i, j] : failingSegments)
+        if (p == plane && mm == module && (x < 0 || (i == x && j == y))) return true;
+    return false;
+}
+
+void readReport(const std::string& reportFile){
+    std::ifstream report(reportFile);
+    if (!report) {
+        std::cout << "Error: cannot open report " << reportFile << std::endl;
+        return;
+    }
+    std::string line;
+    while (std::getline(report, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        // planeID moduleID x y peak hasFit mean sigma chi2NDF relSigma drift refitted failing
+        std::istringstream fields(line);
+        int plane, module, x, y, peak, hasFit, refitted, failing;
+        double mean, sigma, chi2NDF, relSigma, drift;
+        if (fields >> plane >> module >> x >> y >> peak >> hasFit >> mean >> sigma >> chi2NDF >> relSigma >> drift >> refitted >> failing && failing)
+            failingSegments.insert({plane, module, x, y});
+    }
+    std::cout << failingSegments.size() << " segments to review from " << reportFile << std::endl;
+}
+
 TDialogCanvas* createDialog(){
     double width = 300, height = 100;
     int nPlanes = gm.GetNumberOfPlanes();
@@ -343,6 +408,7 @@ TDialogCanvas* createDialog(){
     for (auto pm : gm.GetPlaneIDs()) {
         int j=0;
         for (auto mm : gm.GetModuleIDs(pm)) {
+            if (!isToReview(pm, mm)) continue;
             std::string action = "changeModule(";//
             action += std::to_string(pm)+(string)","+(string)std::to_string(mm) + (string)");";
             std::string name = "Plane " + std::to_string(pm) + ", Module " + std::to_string(mm);
@@ -355,15 +421,16 @@ TDialogCanvas* createDialog(){
         i++;
     }
 
-    TButton *butExport = new TButton("Export", "gm.Export();", .4,.1,.6,.3);
+    TButton *butExport = new TButton("Export", "exportGainMap();", .4,.1,.6,.3);
     butExport->Draw();
     return dialog;
 }
 
-void refitGainMap(std::string gainMapFile = "data/testing_Cal_D01983_Hits_ThresholdIntegral_4x4.root"){
+void refitGainMap(std::string gainMapFile = "data/testing_Cal_D01983_Hits_ThresholdIntegral_4x4.root", std::string reportFile = ""){
     //TFile* f = new TFile("data/testing_Cal_D01983_Hits_ThresholdIntegral_4x4.root");
     //gm = *((TRestDataSetGainMap*)  f->Get("calRaw4x4")); 
     gm.Import(gainMapFile); // It doesnt work with gm->Import(). Why?
+    if (!reportFile.empty()) readReport(reportFile);
 
     std::cout << std::endl;
     std::cout << " ************************************************" << std::endl;
@@ -0,0 +1,189 @@
+/////////////////////////////////////////////////////////////////////////
+/// Catalog of the REST files of a directory, so the macros do not need
+/// to open every file just to know its contents.
+///
+/// For each file it stores its size and modification time, the number of
+/// entries and the observables of its AnalysisTree, and the run number,
+/// subrun number and time range of its TRestRun. The catalog of a
+/// directory is the text file RUN_CATALOG_FILE_NAME inside it, with one
+/// tab separated line per file. When it is consulted only the files that
+/// are new, or whose size or modification time changed, are opened (a
+/// stat is much cheaper than opening a ROOT file on a network file
+/// system) and the catalog is written again. If the directory is not
+/// writable the catalog is only kept in memory.
+///
+/// Its use is opt-in (useCatalog of createDataSet and calibrate), as it
+/// writes a hidden file into the data directories, and its scope is
+/// limited: it only replaces the opens done to inspect the files (the
+/// observables of the first input file of createDataSet, the entries of
+/// the data set to calibrate). TRestDataSet::GenerateDataSet and the
+/// calibration still open every file they read. The run numbers and
+/// time ranges are stored to describe the runs, but are not used by
+/// these macros.
+///
+/// \author: Álvaro Ezquerro aezquerro@unizar.es
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef REST_MACROS_RUN_CATALOG_H
+#define REST_MACROS_RUN_CATALOG_H
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TRestAnalysisTree.h>
+#include <TRestRun.h>
+#include <TRestTools.h>
+#include <TSystem.h>
+#include <TTree.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define RUN_CATALOG_FILE_NAME ".restRunCatalog.tsv"
+/// First line of the catalog. Catalogs with another header (written by an
+/// older version) are discarded and rebuilt.
+#define RUN_CATALOG_HEADER "# restRunCatalog v2"
+
+struct RunCatalogEntry {
+    Long64_t fSize = -1;
+    Long_t fModificationTime = -1;
+    bool fHasAnalysisTree = false;
+    Long64_t fEntries = 0;
+    int fRunNumber = -1;
+    int fSubRunNumber = -1;
+    double fStartTime = 0;
+    double fEndTime = 0;
+    std::vector<std::string> fObservables;
+};
+
+/// Opens fileName and fills entry with its contents (the file stat must be
+/// already set).
+inline void scanRunCatalogEntry(const std::string& fileName, RunCatalogEntry& entry) {
+    std::unique_ptr<TFile> f(TFile::Open(fileName.c_str()));
+    if (!f || f->IsZombie()) return;
+
+    // Data sets written by TRestDataSet::Export store the AnalysisTree as a plain TTree
+    std::unique_ptr<TTree> tree(f->Get<TTree>("AnalysisTree"));
+    if (tree) {
+        entry.fHasAnalysisTree = true;
+        entry.fEntries = tree->GetEntries();
+        if (auto analysisTree = dynamic_cast<TRestAnalysisTree*>(tree.get()))
+            entry.fObservables = analysisTree->GetObservableNames();
+        else
+            for (auto branch : *tree->GetListOfBranches()) entry.fObservables.push_back(branch->GetName());
+    }
+    for (auto key : *f->GetListOfKeys()) {
+        if ((std::string)((TKey*)key)->GetClassName() != "TRestRun") continue;
+        std::unique_ptr<TRestRun> run(((TKey*)key)->ReadObject<TRestRun>());
+        if (!run) break;
+        entry.fRunNumber = run->GetRunNumber();
+        entry.fSubRunNumber = run->GetSubRunNumber();
+        entry.fStartTime = run->GetStartTimestamp();
+        entry.fEndTime = run->GetEndTimestamp();
+        break;
+    }
+}
+
+/// Reads the catalog of directory (empty if it does not exist yet). The
+/// keys are the file names without the path.
+inline std::map<std::string, RunCatalogEntry> readRunCatalog(const std::string& directory) {
+    std::map<std::string, RunCatalogEntry> catalog;
+    std::ifstream in(directory + "/" + RUN_CATALOG_FILE_NAME);
+    std::string line;
+    if (!std::getline(in, line) || line != RUN_CATALOG_HEADER) return catalog;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string name, observables;
+        RunCatalogEntry entry;
+        std::getline(fields, name, '\t');
+        fields >> entry.fSize >> entry.fModificationTime >> entry.fHasAnalysisTree >> entry.fEntries >>
+            entry.fRunNumber >> entry.fSubRunNumber >> entry.fStartTime >> entry.fEndTime;
+        if (fields.fail()) continue;
+        fields.ignore(1);
+        std::getline(fields, observables);
+        std::istringstream obs(observables);
+        for (std::string o; std::getline(obs, o, ',');)
+            if (!o.empty()) entry.fObservables.push_back(o);
+        catalog[name] = entry;
+    }
+    return catalog;
+}
+
+/// Writes the catalog of directory. Returns false if it could not be
+/// written (e.g. the directory is not writable).
+inline bool writeRunCatalog(const std::string& directory, const std::map<std::string, RunCatalogEntry>& catalog) {
+    // Written to a temporary file and renamed, so a concurrent reader never sees a partial catalog
+    const std::string fileName = directory + "/" + RUN_CATALOG_FILE_NAME;
+    const std::string tmpFileName = fileName + "." + std::to_string(gSystem->GetPid());
+    {
+        std::ofstream out(tmpFileName);
+        if (!out) return false;
+        out << RUN_CATALOG_HEADER << std::endl;
+        out << "# fileName\tsize\tmtime\thasAnalysisTree\tentries\trunNumber\tsubRunNumber\tstartTime\tendTime\t"
+               "observables"
+            << std::endl;
+        out.precision(15);
+        for (const auto& [name, entry] : catalog) {
+            out << name << "\t" << entry.fSize << "\t" << entry.fModificationTime << "\t" << entry.fHasAnalysisTree
+                << "\t" << entry.fEntries << "\t" << entry.fRunNumber << "\t" << entry.fSubRunNumber << "\t"
+                << entry.fStartTime << "\t" << entry.fEndTime << "\t";
+            for (size_t i = 0; i < entry.fObservables.size(); i++)
+                out << (i ? "," : "") << entry.fObservables[i];
+            out << "\n";
+        }
+        if (!out) return false;
+    }
+    return gSystem->Rename(tmpFileName.c_str(), fileName.c_str()) == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// Returns the catalog entries of fileNames (keyed by the given names),
+/// refreshing the catalogs of their directories where needed. Files that
+/// do not exist have fSize = -1.
+/////////////////////////////////////////////////////////////////////////
+inline std::map<std::string, RunCatalogEntry> getRunCatalog(const std::vector<std::string>& fileNames) {
+    std::map<std::string, std::vector<std::string>> filesPerDirectory;
+    for (const auto& fileName : fileNames) {
+        auto [path, name] = TRestTools::SeparatePathAndName(fileName);
+        filesPerDirectory[path.empty() ? "." : path].push_back(fileName);
+    }
+
+    std::map<std::string, RunCatalogEntry> result;
+    for (const auto& [directory, files] : filesPerDirectory) {
+        auto catalog = readRunCatalog(directory);
+        size_t nScanned = 0;
+        for (const auto& fileName : files) {
+            const std::string name = TRestTools::SeparatePathAndName(fileName).second;
+            FileStat_t fileStat;
+            if (gSystem->GetPathInfo(fileName.c_str(), fileStat) != 0) {
+                result[fileName] = RunCatalogEntry();
+                continue;
+            }
+            auto it = catalog.find(name);
+            if (it == catalog.end() || it->second.fSize != fileStat.fSize ||
+                it->second.fModificationTime != fileStat.fMtime) {
+                RunCatalogEntry entry;
+                entry.fSize = fileStat.fSize;
+                entry.fModificationTime = fileStat.fMtime;
+                scanRunCatalogEntry(fileName, entry);
+                it = catalog.insert_or_assign(name, entry).first;
+                nScanned++;
+            }
+            result[fileName] = it->second;
+        }
+        if (nScanned > 0) {
+            std::cout << "Run catalog of " << directory << ": " << nScanned << " of " << files.size()
+                      << " files scanned" << std::endl;
+            if (!writeRunCatalog(directory, catalog))
+                std::cout << "Warning: could not write the run catalog of " << directory << std::endl;
+        }
+    }
+    return result;
+}
+
+#endif
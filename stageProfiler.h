@@ -0,0 +1,213 @@
+/////////////////////////////////////////////////////////////////////////
+/// Per stage instrumentation of the macros (opt-in).
+///
+/// Each stage (e.g. the rml parsing, GenerateGainMap or Export of a
+/// given rml file or module) is measured by a StageProfiler::Scope
+/// living while it runs, which records its wall time, CPU time, peak
+/// resident memory of the process at its end, bytes read and written by
+/// ROOT files and, when set, the entries processed. A Scope built with a
+/// null profiler does nothing, so the macros pass nullptr when the
+/// profiling is not enabled.
+///
+/// The CPU time, memory and bytes are those of the whole process (from
+/// getrusage and TFile::GetFileBytesRead/Written), so for stages running
+/// concurrently they include the work of the other threads.
+///
+/// Write() appends the stages to a file, so it can be used to track the
+/// time of the same workflow across runs:
+/// * .root: TTree "stageProfile" (one entry per stage).
+/// * any other extension: JSON lines (one JSON object per stage).
+/// Every stage carries the time (unix) the profiler was created, to tell
+/// the runs apart.
+///
+/// \author: Álvaro Ezquerro aezquerro@unizar.es
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef REST_MACROS_STAGE_PROFILER_H
+#define REST_MACROS_STAGE_PROFILER_H
+
+#include <TFile.h>
+#include <TTree.h>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class StageProfiler {
+   public:
+    struct Stage {
+        std::string fMacro;
+        std::string fName;
+        /// What the stage worked on (e.g. the rml file, the module or the output file)
+        std::string fContext;
+        double fWallTime = 0;  // s
+        double fCpuTime = 0;   // s
+        long fPeakRSS = 0;     // kB
+        Long64_t fBytesRead = 0;
+        Long64_t fBytesWritten = 0;
+        Long64_t fEntries = 0;
+    };
+
+    class Scope {
+       public:
+        Scope(StageProfiler* profiler, const std::string& name, const std::string& context = "")
+            : fProfiler(profiler) {
+            if (!fProfiler) return;
+            fStage.fMacro = fProfiler->fMacro;
+            fStage.fName = name;
+            fStage.fContext = context;
+            fBegin = std::chrono::steady_clock::now();
+            fCpuBegin = GetCpuTime();
+            fBytesReadBegin = TFile::GetFileBytesRead();
+            fBytesWrittenBegin = TFile::GetFileBytesWritten();
+        }
+
+        ~Scope() {
+            if (!fProfiler) return;
+            fStage.fWallTime =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - fBegin).count();
+            fStage.fCpuTime = GetCpuTime() - fCpuBegin;
+            rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            fStage.fPeakRSS = usage.ru_maxrss;
+            fStage.fBytesRead = TFile::GetFileBytesRead() - fBytesReadBegin;
+            fStage.fBytesWritten = TFile::GetFileBytesWritten() - fBytesWrittenBegin;
+            fProfiler->Add(fStage);
+        }
+
+        void SetEntries(const Long64_t entries) { fStage.fEntries = entries; }
+
+       private:
+        static double GetCpuTime() {
+            rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                   1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+        }
+
+        StageProfiler* fProfiler;
+        Stage fStage;
+        std::chrono::steady_clock::time_point fBegin;
+        double fCpuBegin = 0;
+        Long64_t fBytesReadBegin = 0;
+        Long64_t fBytesWrittenBegin = 0;
+    };
+
+    explicit StageProfiler(const std::string& macro) : fMacro(macro), fRunTime(std::time(nullptr)) {}
+
+    void Add(const Stage& stage) {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fStages.push_back(stage);
+    }
+
+    /// Sets the entries of the last recorded stage, for stages whose entries
+    /// are only known (or counted) after they finish.
+    void SetEntries(const Long64_t entries) {
+        std::lock_guard<std::mutex> lock(fMutex);
+        if (!fStages.empty()) fStages.back().fEntries = entries;
+    }
+
+    /// Prints a table of the stages.
+    void Print() const {
+        std::cout << "Stage profile of " << fMacro << ":" << std::endl;
+        for (const auto& stage : fStages) {
+            std::cout << "\t" << stage.fName << (stage.fContext.empty() ? "" : " (" + stage.fContext + ")")
+                      << ": wall " << stage.fWallTime << " s, CPU " << stage.fCpuTime << " s, peak RSS "
+                      << stage.fPeakRSS / 1024. << " MB, read " << stage.fBytesRead / 1e6 << " MB, written "
+                      << stage.fBytesWritten / 1e6 << " MB";
+            if (stage.fEntries > 0)
+                std::cout << ", " << stage.fEntries << " entries (" << stage.fEntries / stage.fWallTime
+                          << " entries/s)";
+            std::cout << std::endl;
+        }
+    }
+
+    /// Appends the stages to fileName (see the format above).
+    void Write(const std::string& fileName) const {
+        const bool isRoot = fileName.size() > 5 && fileName.substr(fileName.size() - 5) == ".root";
+        if (isRoot)
+            WriteTree(fileName);
+        else
+            WriteJson(fileName);
+        std::cout << "Stage profile written to " << fileName << std::endl;
+    }
+
+   private:
+    static std::string Escape(const std::string& text) {
+        std::string escaped;
+        for (const char c : text) {
+            if (c == '"' || c == '\\') escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    void WriteJson(const std::string& fileName) const {
+        std::ofstream out(fileName, std::ios::app);
+        for (const auto& stage : fStages) {
+            out << "{\"runTime\": " << fRunTime << ", \"macro\": \"" << Escape(stage.fMacro) << "\", \"stage\": \""
+                << Escape(stage.fName) << "\", \"context\": \"" << Escape(stage.fContext)
+                << "\", \"wallTime\": " << stage.fWallTime << ", \"cpuTime\": " << stage.fCpuTime
+                << ", \"peakRSSkB\": " << stage.fPeakRSS << ", \"bytesRead\": " << stage.fBytesRead
+                << ", \"bytesWritten\": " << stage.fBytesWritten << ", \"entries\": " << stage.fEntries << "}"
+                << std::endl;
+        }
+    }
+
+    void WriteTree(const std::string& fileName) const {
+        std::unique_ptr<TFile> f(TFile::Open(fileName.c_str(), "UPDATE"));
+        if (!f || f->IsZombie()) {
+            std::cout << "Error: cannot open " << fileName << std::endl;
+            return;
+        }
+        Long64_t runTime = fRunTime;
+        Stage stage;
+        std::string* macro = &stage.fMacro;
+        std::string* name = &stage.fName;
+        std::string* context = &stage.fContext;
+        TTree* tree = f->Get<TTree>("stageProfile");
+        if (tree) {
+            tree->SetBranchAddress("runTime", &runTime);
+            tree->SetBranchAddress("macro", &macro);
+            tree->SetBranchAddress("stage", &name);
+            tree->SetBranchAddress("context", &context);
+            tree->SetBranchAddress("wallTime", &stage.fWallTime);
+            tree->SetBranchAddress("cpuTime", &stage.fCpuTime);
+            tree->SetBranchAddress("peakRSSkB", &stage.fPeakRSS);
+            tree->SetBranchAddress("bytesRead", &stage.fBytesRead);
+            tree->SetBranchAddress("bytesWritten", &stage.fBytesWritten);
+            tree->SetBranchAddress("entries", &stage.fEntries);
+        } else {
+            tree = new TTree("stageProfile", "Stage profile of the macros");
+            tree->Branch("runTime", &runTime);
+            tree->Branch("macro", &macro);
+            tree->Branch("stage", &name);
+            tree->Branch("context", &context);
+            tree->Branch("wallTime", &stage.fWallTime);
+            tree->Branch("cpuTime", &stage.fCpuTime);
+            tree->Branch("peakRSSkB", &stage.fPeakRSS);
+            tree->Branch("bytesRead", &stage.fBytesRead);
+            tree->Branch("bytesWritten", &stage.fBytesWritten);
+            tree->Branch("entries", &stage.fEntries);
+        }
+        for (const auto& s : fStages) {
+            stage = s;
+            tree->Fill();
+        }
+        tree->Write("", TObject::kOverwrite);
+        f->Close();
+    }
+
+    std::string fMacro;
+    Long64_t fRunTime;
+    std::mutex fMutex;
+    std::vector<Stage> fStages;
+};
+
+#endif
@@ -0,0 +1,296 @@
+/////////////////////////////////////////////////////////////////////////
+/// Benchmark of the compiled macros on synthetic data.
+///
+/// It generates a run of nFiles subruns (R09999_XXXXX_Bench.root) with
+/// nEvents events each, whose AnalysisTree has a position dependent gain
+/// and two calibration peaks (22.1 and 8.0 keV), plus the rml of a 4x4
+/// TRestDataSetGainMap for it. Then it times:
+/// * createDataSet on the run (events/s and input MB/s),
+/// * calibrate of the resulting data set, generating the gain map
+///   (events/s),
+/// * copyObjects of the subruns, normal and fastMerge (input MB/s),
+/// * WIMP_Sensitivity (masses/s, counting only the masses above the
+///   threshold, the ones evaluated) with a synthetic TRestWimpSensitivity
+///   rml (Ne + H), or wimpRml if given.
+///
+/// The results are written to workDir/benchmarkResults.txt and compared
+/// with baselineFile (one "metric value unit" line per metric): the
+/// program fails (exit code 1) if any metric is below its baseline by
+/// more than tolerance, or if it is not in the baseline (e.g. the
+/// baseline was not generated yet). With updateBaseline the results are
+/// written to baselineFile instead. The baseline depends on the machine,
+/// so it must be generated on the one running the benchmark.
+///
+/// \author: Álvaro Ezquerro aezquerro@unizar.es
+/////////////////////////////////////////////////////////////////////////
+
+#include <TFile.h>
+#include <TRandom3.h>
+#include <TRestAnalysisTree.h>
+#include <TRestRun.h>
+#include <TRestWimpSensitivity.h>
+#include <TSystem.h>
+#include <TTree.h>
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "argParser.h"
+#include "restMacros.h"
+
+struct Metric {
+    std::string name;
+    double value;
+    std::string unit;
+};
+
+/// Writes the synthetic subruns to directory and returns their names.
+std::vector<std::string> generateSyntheticRun(const std::string& directory, const int nFiles, const int nEvents,
+                                              const int nExtraObservables) {
+    const double readoutSize = 246.24;
+    TRandom3 random(1850);
+    std::vector<std::string> fileNames;
+    for (int f = 0; f < nFiles; f++) {
+        std::ostringstream fileName;
+        fileName << directory << "/R09999_" << std::setw(5) << std::setfill('0') << f << "_Bench.root";
+        TFile file(fileName.str().c_str(), "RECREATE");
+
+        TRestRun run;
+        run.SetName("run");
+        run.SetRunNumber(9999);
+        run.SetStartTimeStamp(1.7e9 + 3600 * f);
+        run.SetEndTimeStamp(1.7e9 + 3600 * (f + 1));
+
+        TRestAnalysisTree* tree = new TRestAnalysisTree("AnalysisTree", "AnalysisTree");
+        for (int e = 0; e < nEvents; e++) {
+            const double x = random.Uniform(0, readoutSize);
+            const double y = random.Uniform(0, readoutSize);
+            const double gain = 1000 * (1 + 0.2 * std::sin(x / 50) * std::cos(y / 50));
+            const double energy = random.Uniform() < 0.6 ? 22.1 : 8.0;
+            const double resolution = 0.1 * std::sqrt(22.1 / energy);
+            tree->SetObservableValue("rawAna_ThresholdIntegral", gain * random.Gaus(energy, resolution * energy));
+            tree->SetObservableValue("hitsAna_xMean", x);
+            tree->SetObservableValue("hitsAna_yMean", y);
+            for (int o = 0; o < nExtraObservables; o++)
+                tree->SetObservableValue("benchAna_extra" + std::to_string(o), random.Gaus());
+            tree->Fill();
+        }
+        tree->Write();
+        run.Write();
+        file.Close();
+        fileNames.push_back(fileName.str());
+    }
+    return fileNames;
+}
+
+/// Writes the rml of a 4x4 gain map calibrating dataSetFileName.
+void writeGainMapRml(const std::string& rmlFileName, const std::string& dataSetFileName,
+                     const std::string& gainMapFileName) {
+    std::ofstream rml(rmlFileName);
+    rml << "<TRestDataSetGainMap name=\"calBench\" title=\"Benchmark gain map\" verboseLevel=\"warning\">\n"
+        << "    <parameter name=\"calibFileName\" value=\"" << dataSetFileName << "\"/>\n"
+        << "    <parameter name=\"outputFileName\" value=\"" << gainMapFileName << "\"/>\n"
+        << "    <parameter name=\"observable\" value=\"rawAna_ThresholdIntegral\"/>\n"
+        << "    <parameter name=\"spatialObservableX\" value=\"hitsAna_xMean\"/>\n"
+        << "    <parameter name=\"spatialObservableY\" value=\"hitsAna_yMean\"/>\n"
+        << "    <module planeId=\"0\" moduleId=\"0\" moduleDefinitionCut=\"hitsAna_xMean>=0\"\n"
+        << "            numberOfSegmentsX=\"4\" numberOfSegmentsY=\"4\" readoutRange=\"(0,246.24)\">\n"
+        << "        <peak energy=\"22.1\" range=\"\"/>\n"
+        << "        <peak energy=\"8.0\" range=\"\"/>\n"
+        << "    </module>\n"
+        << "</TRestDataSetGainMap>\n";
+}
+
+/// Writes the rml of a TRestWimpSensitivity for a Ne + 1% H gas with a
+/// flat background.
+void writeWimpRml(const std::string& rmlFileName) {
+    std::ofstream rml(rmlFileName);
+    rml << "<TRestWimpSensitivity name=\"wimpBench\" title=\"Benchmark WIMP sensitivity\" verboseLevel=\"warning\">\n"
+        << "    <addElement nucleusName=\"Ne\" anum=\"20.1797\" znum=\"10\" abundance=\"0.99\"/>\n"
+        << "    <addElement nucleusName=\"H\" anum=\"1.00784\" znum=\"1\" abundance=\"0.01\"/>\n"
+        << "    <parameter name=\"wimpDensity\" value=\"0.3\" units=\"GeV/cm3\"/>\n"
+        << "    <parameter name=\"labVelocity\" value=\"232\" units=\"km/s\"/>\n"
+        << "    <parameter name=\"rmsVelocity\" value=\"220\" units=\"km/s\"/>\n"
+        << "    <parameter name=\"escapeVelocity\" value=\"544\" units=\"km/s\"/>\n"
+        << "    <parameter name=\"exposure\" value=\"365\" units=\"kg*day\"/>\n"
+        << "    <parameter name=\"background\" value=\"1\"/>\n"
+        << "    <parameter name=\"energySpectra\" value=\"(0,2)\" units=\"keV\"/>\n"
+        << "    <parameter name=\"energySpectraStep\" value=\"0.01\" units=\"keV\"/>\n"
+        << "    <parameter name=\"energyRange\" value=\"(0.1,2)\" units=\"keV\"/>\n"
+        << "    <parameter name=\"useQuenchingFactor\" value=\"true\"/>\n"
+        << "</TRestWimpSensitivity>\n";
+}
+
+/// Number of masses of the log grid of WIMP_Sensitivity (numPoints + 1
+/// masses from wimpStart to wimpEnd) that it evaluates, i.e. those above
+/// the threshold mass written in the header of its .dat file.
+int getEvaluatedWimpMasses(const std::string& rmlFileName, const double wimpStart, const double wimpEnd,
+                           const int numPoints) {
+    const std::string datFileName = TRestWimpSensitivity(rmlFileName.c_str()).BuildOutputFileName(".dat");
+    std::ifstream dat(datFileName);
+    const std::string thresholdLine = "# Threshold WIMP mass: ";
+    double thresholdMass = -1;
+    for (std::string line; std::getline(dat, line) && line.rfind("#", 0) == 0;)
+        if (line.rfind(thresholdLine, 0) == 0) thresholdMass = std::stod(line.substr(thresholdLine.size()));
+    if (thresholdMass < 0) {
+        std::cout << "Error: no threshold mass in " << datFileName << std::endl;
+        return 0;
+    }
+    int nEvaluated = 0;
+    const double logStart = std::log10(wimpStart), step = (std::log10(wimpEnd) - logStart) / numPoints;
+    for (int i = 0; i <= numPoints; i++) nEvaluated += std::pow(10, logStart + i * step) >= thresholdMass;
+    return nEvaluated;
+}
+
+/// Wall time (s) spent running f.
+template <typename F>
+double timeIt(F f) {
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+Long64_t getEntries(const std::string& fileName) {
+    std::unique_ptr<TFile> f(TFile::Open(fileName.c_str()));
+    TTree* tree = f ? f->Get<TTree>("AnalysisTree") : nullptr;
+    return tree ? tree->GetEntries() : 0;
+}
+
+double getTotalMB(const std::vector<std::string>& fileNames) {
+    double bytes = 0;
+    for (const auto& fileName : fileNames) {
+        FileStat_t fileStat;
+        if (gSystem->GetPathInfo(fileName.c_str(), fileStat) == 0) bytes += fileStat.fSize;
+    }
+    return bytes / 1e6;
+}
+
+std::map<std::string, Metric> readMetrics(const std::string& fileName) {
+    std::map<std::string, Metric> metrics;
+    std::ifstream in(fileName);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        Metric metric;
+        if (fields >> metric.name >> metric.value >> metric.unit) metrics[metric.name] = metric;
+    }
+    return metrics;
+}
+
+void writeMetrics(const std::string& fileName, const std::vector<Metric>& metrics) {
+    std::ofstream out(fileName);
+    out << "# metric value unit" << std::endl;
+    for (const auto& metric : metrics) out << metric.name << " " << metric.value << " " << metric.unit << std::endl;
+}
+
+int main(int argc, char** argv) {
+    ArgParser args(argc, argv,
+                   "[workDir] [nFiles] [nEvents] [nExtraObservables] [baselineFile] [updateBaseline] [tolerance] "
+                   "[wimpRml]");
+    if (args.Help()) return args.ExitCode();
+
+    std::string workDir, baselineFile, wimpRml;
+    int nFiles, nEvents, nExtraObservables;
+    bool updateBaseline;
+    double tolerance;
+    try {
+        workDir = args.Get(0, "benchmarkData");
+        nFiles = args.Get(1, 20);
+        nEvents = args.Get(2, 20000);
+        nExtraObservables = args.Get(3, 50);
+        baselineFile = args.Get(4, REST_MACROS_BENCHMARK_BASELINE);
+        updateBaseline = args.Get(5, false);
+        tolerance = args.Get(6, 0.2);
+        wimpRml = args.Get(7, "");
+    } catch (const std::invalid_argument& e) {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    gSystem->mkdir(workDir.c_str(), true);
+    std::vector<Metric> metrics;
+
+    std::vector<std::string> subruns;
+    double seconds = timeIt([&]() { subruns = generateSyntheticRun(workDir, nFiles, nEvents, nExtraObservables); });
+    std::cout << "Generated " << nFiles << " x " << nEvents << " events in " << seconds << " s" << std::endl;
+    const double inputMB = getTotalMB(subruns);
+    const double nTotalEvents = (double)nFiles * nEvents;
+
+    // createDataSet (without catalog, so every run measures the same work)
+    const std::string dataSetFileName = workDir + "/D09999_Bench.root";
+    gSystem->Unlink(dataSetFileName.c_str());
+    seconds = timeIt([&]() {
+        createDataSet(workDir + "/R09999_*_Bench.root", dataSetFileName, "", "", 1, false, false);
+    });
+    metrics.push_back({"createDataSet_events", getEntries(dataSetFileName) / seconds, "events/s"});
+    metrics.push_back({"createDataSet_input", inputMB / seconds, "MB/s"});
+
+    // calibrate, generating the gain map
+    const std::string rmlFileName = workDir + "/calBench.rml";
+    const std::string gainMapFileName = workDir + "/calBench.root";
+    writeGainMapRml(rmlFileName, dataSetFileName, gainMapFileName);
+    gSystem->Unlink(gainMapFileName.c_str());
+    seconds = timeIt([&]() { calibrate(rmlFileName, dataSetFileName, 1, true, false, 1, false); });
+    metrics.push_back({"calibrate_events", nTotalEvents / seconds, "events/s"});
+
+    // copyObjects
+    const std::string mergedFileName = workDir + "/merged.root";
+    for (const bool fastMerge : {false, true}) {
+        gSystem->Unlink(mergedFileName.c_str());
+        seconds = timeIt([&]() { copyObjects(workDir + "/R09999_*_Bench.root", mergedFileName, fastMerge); });
+        metrics.push_back({fastMerge ? "copyObjects_fast_input" : "copyObjects_input", inputMB / seconds, "MB/s"});
+    }
+
+    // WIMP sensitivity, in workDir (where the .dat file is written)
+    if (wimpRml.empty()) {
+        wimpRml = workDir + "/wimpBench.rml";
+        writeWimpRml(wimpRml);
+    }
+    if (!gSystem->IsAbsoluteFileName(wimpRml.c_str())) wimpRml = gSystem->WorkingDirectory() + ("/" + wimpRml);
+    const std::string currentDir = gSystem->WorkingDirectory();
+    gSystem->ChangeDirectory(workDir.c_str());
+    const double wimpStart = 0.1, wimpEnd = 10;
+    const int numPoints = 50;
+    seconds = timeIt([&]() { WIMP_Sensitivity(wimpRml, wimpStart, wimpEnd, numPoints); });
+    const int nMasses = getEvaluatedWimpMasses(wimpRml, wimpStart, wimpEnd, numPoints);
+    gSystem->ChangeDirectory(currentDir.c_str());
+    metrics.push_back({"WIMP_Sensitivity_masses", nMasses / seconds, "masses/s"});
+
+    writeMetrics(workDir + "/benchmarkResults.txt", metrics);
+    if (updateBaseline) {
+        writeMetrics(baselineFile, metrics);
+        std::cout << "Baseline written to " << baselineFile << std::endl;
+    }
+
+    const auto baseline = readMetrics(baselineFile);
+    int nRegressions = 0;
+    std::cout << std::endl << std::left << std::setw(28) << "Metric" << std::setw(14) << "Value" << std::setw(14)
+              << "Baseline" << "Unit" << std::endl;
+    for (const auto& metric : metrics) {
+        std::cout << std::setw(28) << metric.name << std::setw(14) << metric.value;
+        auto it = baseline.find(metric.name);
+        if (it == baseline.end()) {
+            nRegressions++;
+            std::cout << std::setw(14) << "-" << metric.unit << "  NO BASELINE" << std::endl;
+            continue;
+        }
+        const bool regression = metric.value < it->second.value * (1 - tolerance);
+        nRegressions += regression;
+        std::cout << std::setw(14) << it->second.value << metric.unit << (regression ? "  REGRESSION" : "")
+                  << std::endl;
+    }
+    if (baseline.empty())
+        std::cout << "Error: no baseline in " << baselineFile << " (generate it with updateBaseline = 1)" << std::endl;
+    return nRegressions > 0;
+}
@@ -0,0 +1,68 @@
+# Checks that the declarations of restMacros.h have the same parameters
+# and default values as the macros. Run at build time (see
+# CMakeLists.txt) with:
+#   cmake -DMACROS_DIR=<repository> -DHEADER=<restMacros.h> -P checkMacroDefaults.cmake
+# It fails, listing the differences, if they diverge.
+
+set(MACROS
+    "createDataSet:createDataSet.cxx"
+    "calibrate:calibrate.cxx"
+    "copyObjects:copyObjects.cxx"
+    "autoRefitGainMap:autoRefitGainMap.cxx"
+    "WIMP_Sensitivity:WIMP_Sensitivity.C"
+    "WIMP_SensitivitySweep:WIMP_Sensitivity.C"
+    "REST_WIMP_RecoilRateBatch:WIMP_RecoilRate.C")
+
+# Sets out to the parameters of the first declaration or definition of
+# function in file, as a list of "name=default" ("name" if it has no
+# default value), without whitespace.
+function(get_parameters file function out)
+    file(READ "${file}" text)
+    string(FIND "${text}" "void ${function}(" begin)
+    if(begin EQUAL -1)
+        message(FATAL_ERROR "${function} not found in ${file}")
+    endif()
+    string(LENGTH "void ${function}(" length)
+    math(EXPR begin "${begin} + ${length}")
+    string(SUBSTRING "${text}" ${begin} -1 text)
+    # The parameter list ends at the ")" before the body or the ";"
+    string(REGEX MATCH "^[^;{]*\\)[ \t\r\n]*[{;]" text "${text}")
+    if(text STREQUAL "")
+        message(FATAL_ERROR "the parameters of ${function} were not found in ${file}")
+    endif()
+    string(REGEX REPLACE "\\)[ \t\r\n]*[{;]$" "" text "${text}")
+    string(REGEX REPLACE "[ \t\r\n]+" " " text "${text}")
+    string(REPLACE ";" "\\;" text "${text}")
+    string(REPLACE "," ";" text "${text}")
+    set(parameters)
+    foreach(parameter IN LISTS text)
+        string(FIND "${parameter}" "=" equal)
+        set(default "")
+        if(NOT equal EQUAL -1)
+            string(SUBSTRING "${parameter}" ${equal} -1 default)
+            string(REPLACE " " "" default "${default}")
+            string(SUBSTRING "${parameter}" 0 ${equal} parameter)
+        endif()
+        string(REGEX MATCH "[A-Za-z_][A-Za-z0-9_]*[ ]*$" name "${parameter}")
+        string(STRIP "${name}" name)
+        list(APPEND parameters "${name}${default}")
+    endforeach()
+    set(${out} "${parameters}" PARENT_SCOPE)
+endfunction()
+
+set(nErrors 0)
+foreach(macro IN LISTS MACROS)
+    string(REPLACE ":" ";" macro "${macro}")
+    list(GET macro 0 function)
+    list(GET macro 1 source)
+    get_parameters("${HEADER}" ${function} declared)
+    get_parameters("${MACROS_DIR}/${source}" ${function} defined)
+    if(NOT declared STREQUAL defined)
+        message(SEND_ERROR "${function}: the parameters of restMacros.h differ from the ones of ${source}\n"
+                           "  restMacros.h: ${declared}\n  ${source}: ${defined}")
+        math(EXPR nErrors "${nErrors} + 1")
+    endif()
+endforeach()
+if(nErrors GREATER 0)
+    message(FATAL_ERROR "restMacros.h does not match ${nErrors} macros")
+endif()
@@ -0,0 +1,147 @@
+/////////////////////////////////////////////////////////////////////////
+/// Minimal command line parsing for the compiled macros.
+///
+/// The arguments are positional and follow the order of the parameters
+/// of the macro, so `restCalibrate cal.rml D01850.root 4` is the same as
+/// `calibrate("cal.rml", "D01850.root", 4)`. Missing arguments take the
+/// default value of the macro: REST_MACRO_CALL calls it with only the
+/// arguments given, converted to the types of its parameters, so the
+/// default values are only written in the declaration of the macro.
+/// Booleans are given as 1/0 or true/false and vectors as comma separated
+/// lists (e.g. 0.1,1,10).
+///
+/// \author: Álvaro Ezquerro aezquerro@unizar.es
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef REST_MACROS_ARG_PARSER_H
+#define REST_MACROS_ARG_PARSER_H
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// Calls macro with the command line arguments of args (see
+/// ArgParser::Call) and returns the exit code of the program.
+#define REST_MACRO_CALL(args, macro)                                                         \
+    (args).Call(&macro, [](auto&&... a) -> decltype(macro(std::forward<decltype(a)>(a)...)) { \
+        macro(std::forward<decltype(a)>(a)...);                                              \
+    })
+
+class ArgParser {
+   public:
+    /// usage is printed with -h or --help, or if fewer than nRequired
+    /// arguments are given.
+    ArgParser(int argc, char** argv, const std::string& usage, const size_t nRequired = 0) {
+        for (int i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "-h" || arg == "--help") fHelp = true;
+            fArgs.push_back(arg);
+        }
+        fMissing = !fHelp && fArgs.size() < nRequired;
+        if (fHelp || fMissing) std::cout << "Usage: " << argv[0] << " " << usage << std::endl;
+    }
+
+    /// True if the usage was printed (the program should exit with ExitCode()).
+    bool Help() const { return fHelp || fMissing; }
+
+    /// Exit code of the program after printing the usage: 0 if it was
+    /// asked for (-h or --help), 1 if required arguments are missing.
+    int ExitCode() const { return fMissing ? 1 : 0; }
+
+    size_t Size() const { return fArgs.size(); }
+
+    std::string Get(const size_t i, const std::string& def) const { return i < fArgs.size() ? fArgs[i] : def; }
+    std::string Get(const size_t i, const char* def) const { return Get(i, std::string(def)); }
+
+    int Get(const size_t i, const int def) const {
+        return i < fArgs.size() ? Convert<int>(i, [](const std::string& s) { return std::stoi(s); }) : def;
+    }
+
+    double Get(const size_t i, const double def) const {
+        return i < fArgs.size() ? Convert<double>(i, [](const std::string& s) { return std::stod(s); }) : def;
+    }
+
+    bool Get(const size_t i, const bool def) const {
+        if (i >= fArgs.size()) return def;
+        const std::string& arg = fArgs[i];
+        if (arg == "1" || arg == "true") return true;
+        if (arg == "0" || arg == "false") return false;
+        throw std::invalid_argument("argument " + std::to_string(i + 1) + " (" + arg + ") is not a boolean");
+    }
+
+    std::vector<double> Get(const size_t i, const std::vector<double>& def) const {
+        if (i >= fArgs.size()) return def;
+        std::vector<double> values;
+        std::istringstream list(fArgs[i]);
+        for (std::string value; std::getline(list, value, ',');)
+            if (!value.empty()) values.push_back(std::stod(value));
+        return values;
+    }
+
+    /////////////////////////////////////////////////////////////////////////
+    /// Calls call with the arguments given, converted to the types of the
+    /// parameters of macro. call must forward them to macro and only accept
+    /// the numbers of arguments macro accepts (see REST_MACRO_CALL), so the
+    /// missing ones take the default values of macro. Returns 0, or 1 if the
+    /// arguments are wrong.
+    /////////////////////////////////////////////////////////////////////////
+    template <typename R, typename... Params, typename F>
+    int Call(R (*)(Params...), F call) const {
+        if (fArgs.size() > sizeof...(Params)) {
+            std::cout << "Error: too many arguments (" << fArgs.size() << ", at most " << sizeof...(Params) << ")"
+                      << std::endl;
+            return 1;
+        }
+        try {
+            if (!CallWithSize<std::tuple<std::decay_t<Params>...>>(call,
+                                                                   std::make_index_sequence<sizeof...(Params) + 1>())) {
+                std::cout << "Error: missing arguments" << std::endl;
+                return 1;
+            }
+        } catch (const std::invalid_argument& e) {
+            std::cout << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+   private:
+    // Calls call with the first N arguments of fArgs, if it accepts N arguments
+    template <typename Types, typename F, size_t... I>
+    bool CallWithFirst(F& call, std::index_sequence<I...>) const {
+        if constexpr (std::is_invocable_v<F&, std::tuple_element_t<I, Types>...>) {
+            call(Get(I, std::tuple_element_t<I, Types>())...);
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    // Calls CallWithFirst with N = fArgs.size()
+    template <typename Types, typename F, size_t... N>
+    bool CallWithSize(F& call, std::index_sequence<N...>) const {
+        bool called = false;
+        ((fArgs.size() == N ? (called = CallWithFirst<Types>(call, std::make_index_sequence<N>())) : false), ...);
+        return called;
+    }
+
+    template <typename T, typename F>
+    T Convert(const size_t i, F convert) const {
+        try {
+            return convert(fArgs[i]);
+        } catch (const std::exception&) {
+            throw std::invalid_argument("argument " + std::to_string(i + 1) + " (" + fArgs[i] + ") is not a number");
+        }
+    }
+
+    std::vector<std::string> fArgs;
+    bool fHelp = false;
+    bool fMissing = false;
+};
+
+#endif
@@ -0,0 +1,51 @@
+/////////////////////////////////////////////////////////////////////////
+/// Declarations of the macros compiled into the restMacros library
+/// (see tools/CMakeLists.txt). The default values must match the ones
+/// of the macros. They are the only other copy: the command line tools
+/// omit the arguments not given (see REST_MACRO_CALL in argParser.h).
+/// The build fails if they differ (see cmake/checkMacroDefaults.cmake).
+///
+/// \author: Álvaro Ezquerro aezquerro@unizar.es
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef REST_MACROS_H
+#define REST_MACROS_H
+
+#include <string>
+#include <vector>
+
+void createDataSet(std::string filePattern = "./data/R01850_*_Hits_Calibration_109Cd_Both_cronTREX_V2.3.13.root",
+                   std::string outputFileName = "", const std::string& includeRegex = "",
+                   const std::string& excludeRegex = "", const int nThreads = 1, const bool append = false,
+                   const bool useCatalog = false, const std::string& compression = "",
+                   const double memoryBudgetMB = 0, const std::string& profileOutput = "",
+                   const int clusterSize = 0, const int basketSize = 0);
+
+void calibrate(const std::string& rmlFile, const std::string& dataSetToCalibrate = "",
+               const int nParallelFiles = 1, const bool singlePass = false, const bool friendOutput = false,
+               const int nFitThreads = 1, const bool useCatalog = false, const std::string& profileOutput = "");
+
+void copyObjects(const std::string& inputFileName, const std::string& outputFileName,
+                 const bool fastMerge = false, const int nOpenThreads = 1, const bool skipDuplicates = true,
+                 const bool compact = false);
+
+void autoRefitGainMap(const std::string& gainMapFile, std::string outputFileName = "",
+                      std::string reportFileName = "", const double maxChi2NDF = 5,
+                      const double maxRelSigma = 0.5, const double maxDrift = 0.2, const int nThreads = 0);
+
+void WIMP_Sensitivity(const std::string& rmlFile, const double wimpStart = 0.01, const double wimpEnd = 50,
+                      const int numPoints = 250, const bool useLogScale = true, const int nThreads = 1,
+                      const double adaptiveTolerance = 0, const int maxEvaluations = 250,
+                      const bool checkpoint = false, const int nParallelFiles = 1);
+
+void WIMP_SensitivitySweep(const std::string& rmlFile, const std::vector<double>& exposures,
+                           const std::vector<double>& backgrounds, const double wimpStart = 0.01,
+                           const double wimpEnd = 50, const int numPoints = 250, const bool useLogScale = true,
+                           const int nThreads = 1, const double crossCheckTolerance = 1E-2);
+
+void REST_WIMP_RecoilRateBatch(const std::string& rmlFile, const std::vector<double>& wimpMasses,
+                               const std::vector<double>& crossSections,
+                               const std::string& outputFileName = "WimpRecoilRates.root",
+                               const bool keVee = false);
+
+#endif
@@ -0,0 +1,10 @@
+// Compiled version of WIMP_RecoilRate.C (the interpreter loads these headers automatically)
+#include <TCanvas.h>
+#include <TLegend.h>
+#include <TRestTools.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../../WIMP_RecoilRate.C"
@@ -0,0 +1,8 @@
+// Compiled version of WIMP_Sensitivity.C (the interpreter loads these headers automatically)
+#include <TRestTools.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../../WIMP_Sensitivity.C"
@@ -0,0 +1,9 @@
+// Compiled version of autoRefitGainMap.cxx (the interpreter loads these headers automatically)
+#include <TRestDataSetGainMap.h>
+#include <TRestTools.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../../autoRefitGainMap.cxx"
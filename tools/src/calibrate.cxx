@@ -0,0 +1,12 @@
+// Compiled version of calibrate.cxx (the interpreter loads these headers automatically)
+#include <ROOT/RDataFrame.hxx>
+#include <TRestDataSet.h>
+#include <TRestDataSetGainMap.h>
+#include <TRestStringOutput.h>
+#include <TRestTools.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../../calibrate.cxx"
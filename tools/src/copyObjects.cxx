@@ -0,0 +1,9 @@
+// Compiled version of copyObjects.cxx (the interpreter loads these headers automatically)
+#include <TClass.h>
+#include <TRestTools.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../../copyObjects.cxx"
@@ -0,0 +1,10 @@
+// Compiled version of createDataSet.cxx (the interpreter loads these headers automatically)
+#include <TRestAnalysisTree.h>
+#include <TRestDataSet.h>
+#include <TRestTools.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../../createDataSet.cxx"
@@ -0,0 +1,9 @@
+// Command line version of autoRefitGainMap() (see restMacros.h)
+#include "argParser.h"
+#include "restMacros.h"
+
+int main(int argc, char** argv) {
+    ArgParser args(argc, argv, "gainMapFile [outputFileName] [reportFileName] [maxChi2NDF] [maxRelSigma] [maxDrift] [nThreads]", 1);
+    if (args.Help()) return args.ExitCode();
+    return REST_MACRO_CALL(args, autoRefitGainMap);
+}
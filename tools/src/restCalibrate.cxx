@@ -0,0 +1,9 @@
+// Command line version of calibrate() (see restMacros.h)
+#include "argParser.h"
+#include "restMacros.h"
+
+int main(int argc, char** argv) {
+    ArgParser args(argc, argv, "rmlFile [dataSetToCalibrate] [nParallelFiles] [singlePass] [friendOutput] [nFitThreads] [useCatalog] [profileOutput]", 1);
+    if (args.Help()) return args.ExitCode();
+    return REST_MACRO_CALL(args, calibrate);
+}
@@ -0,0 +1,9 @@
+// Command line version of copyObjects() (see restMacros.h)
+#include "argParser.h"
+#include "restMacros.h"
+
+int main(int argc, char** argv) {
+    ArgParser args(argc, argv, "inputFileName outputFileName [fastMerge] [nOpenThreads] [skipDuplicates] [compact]", 2);
+    if (args.Help()) return args.ExitCode();
+    return REST_MACRO_CALL(args, copyObjects);
+}
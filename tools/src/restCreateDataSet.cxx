@@ -0,0 +1,9 @@
+// Command line version of createDataSet() (see restMacros.h)
+#include "argParser.h"
+#include "restMacros.h"
+
+int main(int argc, char** argv) {
+    ArgParser args(argc, argv, "[filePattern] [outputFileName] [includeRegex] [excludeRegex] [nThreads] [append] [useCatalog] [compression] [memoryBudgetMB] [profileOutput] [clusterSize] [basketSize]", 0);
+    if (args.Help()) return args.ExitCode();
+    return REST_MACRO_CALL(args, createDataSet);
+}
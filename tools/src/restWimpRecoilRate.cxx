@@ -0,0 +1,9 @@
+// Command line version of REST_WIMP_RecoilRateBatch() (see restMacros.h)
+#include "argParser.h"
+#include "restMacros.h"
+
+int main(int argc, char** argv) {
+    ArgParser args(argc, argv, "rmlFile wimpMasses crossSections [outputFileName] [keVee]", 3);
+    if (args.Help()) return args.ExitCode();
+    return REST_MACRO_CALL(args, REST_WIMP_RecoilRateBatch);
+}
@@ -0,0 +1,9 @@
+// Command line version of WIMP_Sensitivity() (see restMacros.h)
+#include "argParser.h"
+#include "restMacros.h"
+
+int main(int argc, char** argv) {
+    ArgParser args(argc, argv, "rmlFile [wimpStart] [wimpEnd] [numPoints] [useLogScale] [nThreads] [adaptiveTolerance] [maxEvaluations] [checkpoint] [nParallelFiles]", 1);
+    if (args.Help()) return args.ExitCode();
+    return REST_MACRO_CALL(args, WIMP_Sensitivity);
+}
@@ -0,0 +1,9 @@
+// Command line version of WIMP_SensitivitySweep() (see restMacros.h)
+#include "argParser.h"
+#include "restMacros.h"
+
+int main(int argc, char** argv) {
+    ArgParser args(argc, argv, "rmlFile exposures backgrounds [wimpStart] [wimpEnd] [numPoints] [useLogScale] [nThreads] [crossCheckTolerance]", 3);
+    if (args.Help()) return args.ExitCode();
+    return REST_MACRO_CALL(args, WIMP_SensitivitySweep);
+}